@@ -1,6 +1,21 @@
 module gpmc_sync #(
     parameter ADDR_WIDTH = 16,
-    parameter DATA_WIDTH = 16
+    parameter DATA_WIDTH = 16,
+    // 0: one write per access, WEn is a level held for the whole access
+    // 1: synchronous burst writes, up to BURST_LEN data beats per access for
+    //    incrementing addresses, the beats cross to clk through an async FIFO
+    parameter BURST = 0,
+    // Burst beat timing, in gpmc_clk cycles, must match the chip select config:
+    // the first beat is sampled WR_FIRST_BEAT clocks after the last clock with
+    // ADVn low (WRACCESSTIME - ADVWROFFTIME), then one every BEAT_CLKS clocks
+    // (PAGEBURSTACCESSTIME) while WEn stays low, for at most BURST_LEN beats
+    // (ATTACHEDDEVICEPAGELENGTH). A single access has to raise WEn before the
+    // second beat time, WEOFFTIME <= WRACCESSTIME + PAGEBURSTACCESSTIME, which
+    // the GPMC then stretches by a beat for every further word of a burst.
+    // WR_FIRST_BEAT is at least 1.
+    parameter BURST_LEN = 8,
+    parameter WR_FIRST_BEAT = 1,
+    parameter BEAT_CLKS = 1
 )(
     input                    clk,
     // GPMC INTERFACE
@@ -17,7 +32,14 @@ module gpmc_sync #(
     output                   cs,
     output [ADDR_WIDTH-1:0]  address,
     output [DATA_WIDTH-1:0]  data_out,
-    input  [DATA_WIDTH-1:0]  data_in
+    input  [DATA_WIDTH-1:0]  data_in,
+
+    // one clk strobe per written word
+    output                   wr_stb,
+    output [ADDR_WIDTH-1:0]  wr_addr,
+    output [DATA_WIDTH-1:0]  wr_data,
+    // sticky, a burst beat was dropped because the FIFO was full
+    output                   wr_ovf
 );
 
 reg [ADDR_WIDTH-1:0] gpmc_addr;
@@ -105,4 +127,129 @@ assign oe = !(!csn && wen && !oen); // oen
 assign address = addr;
 assign data_out = write;
 
+generate
+if (BURST) begin : g_burst
+
+    // clk is at least as fast as gpmc_clk and drains a word every cycle, so a
+    // FIFO the length of a burst only fills if the beat timing is wrong, and
+    // then beats are dropped rather than overwriting unread entries. The read
+    // pointer only crosses back on gpmc_clk edges, so the full check sees it a
+    // few clocks late and errs on the full side.
+    localparam FIFO_AW = (BURST_LEN > 4) ? $clog2(BURST_LEN) : 2;
+
+    reg [ADDR_WIDTH+DATA_WIDTH-1:0] fifo [0:(1<<FIFO_AW)-1];
+    reg [ADDR_WIDTH-1:0] beat_addr;
+    reg [7:0] beat_wait;    // gpmc_clk cycles to the next beat
+    reg [7:0] beats_left;   // beats still allowed in this access
+    reg [FIFO_AW:0] wptr_bin;
+    reg [FIFO_AW:0] wptr_gray;
+    reg [FIFO_AW:0] wptr_gray_sync;
+    reg [FIFO_AW:0] wptr_gray_q;
+    reg [FIFO_AW:0] rptr_bin;
+    reg [FIFO_AW:0] rptr_gray;
+    reg [FIFO_AW:0] rptr_gray_sync;
+    reg [FIFO_AW:0] rptr_gray_q;
+    reg ovf_gpmc;
+    reg [1:0] ovf_sync;
+    reg [ADDR_WIDTH+DATA_WIDTH-1:0] word;
+    reg stb;
+
+    wire [FIFO_AW:0] wptr_next = wptr_bin + 1'b1;
+    wire [FIFO_AW:0] rptr_next = rptr_bin + 1'b1;
+    // full when the write pointer is a lap ahead of the synchronized read pointer
+    wire fifo_full = (wptr_gray == {~rptr_gray_q[FIFO_AW:FIFO_AW-1], rptr_gray_q[FIFO_AW-2:0]});
+
+    initial begin
+        beat_wait <= 0;
+        beats_left <= 0;
+        wptr_bin <= 0;
+        wptr_gray <= 0;
+        wptr_gray_sync <= 0;
+        wptr_gray_q <= 0;
+        rptr_bin <= 0;
+        rptr_gray <= 0;
+        rptr_gray_sync <= 0;
+        rptr_gray_q <= 0;
+        ovf_gpmc <= 1'b0;
+        ovf_sync <= 2'b00;
+        stb <= 1'b0;
+    end
+
+    always @ (negedge gpmc_clk)
+    begin : GPMC_WRITE_BEATS
+        rptr_gray_sync <= rptr_gray;
+        rptr_gray_q <= rptr_gray_sync;
+
+        if (gpmc_csn1)
+            beats_left <= 0;
+        else if (!gpmc_advn && gpmc_wen && gpmc_oen) begin
+            beat_addr <= gpmc_data_in;
+            beat_wait <= WR_FIRST_BEAT - 1;
+            beats_left <= BURST_LEN;
+        end else if (gpmc_advn && (beats_left != 0)) begin
+            if (beat_wait != 0)
+                beat_wait <= beat_wait - 1'b1;
+            else if (gpmc_wen)
+                beats_left <= 0; // a read, or the access ended before this beat
+            else begin
+                if (fifo_full)
+                    ovf_gpmc <= 1'b1;
+                else begin
+                    fifo[wptr_bin[FIFO_AW-1:0]] <= {beat_addr, gpmc_data_in};
+                    wptr_bin <= wptr_next;
+                    wptr_gray <= wptr_next ^ (wptr_next >> 1);
+                end
+                beat_addr <= beat_addr + 1'b1;
+                beat_wait <= BEAT_CLKS - 1;
+                beats_left <= beats_left - 1'b1;
+            end
+        end
+    end
+
+    always @ (posedge clk)
+    begin
+        wptr_gray_sync <= wptr_gray;
+        wptr_gray_q <= wptr_gray_sync;
+        ovf_sync <= {ovf_sync[0], ovf_gpmc};
+
+        stb <= 1'b0;
+        if (rptr_gray != wptr_gray_q) begin
+            word <= fifo[rptr_bin[FIFO_AW-1:0]];
+            stb <= 1'b1;
+            rptr_bin <= rptr_next;
+            rptr_gray <= rptr_next ^ (rptr_next >> 1);
+        end
+    end
+
+    assign wr_stb = stb;
+    assign wr_addr = word[ADDR_WIDTH+DATA_WIDTH-1:DATA_WIDTH];
+    assign wr_data = word[DATA_WIDTH-1:0];
+    assign wr_ovf = ovf_sync[1];
+
+end else begin : g_single
+
+    // strobe in the first clock of the access, where the write enable level
+    // has always started. The address and data come through the same synchronizer as
+    // WEn, so they are valid from then on and held for the whole access.
+    reg wr_act_q;
+
+    wire wr_act = !csn && !wen && oen;
+
+    initial begin
+        wr_act_q <= 1'b0;
+    end
+
+    always @ (posedge clk)
+    begin
+        wr_act_q <= wr_act;
+    end
+
+    assign wr_stb = wr_act && !wr_act_q;
+    assign wr_addr = addr;
+    assign wr_data = write;
+    assign wr_ovf = 1'b0;
+
+end
+endgenerate
+
 endmodule
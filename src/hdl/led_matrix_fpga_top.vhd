@@ -4,7 +4,8 @@
 -- File         : led_matrix_fpga_top.vhd
 -- Generated    : 07/06/2022
 --------------------------------------------------------------------------------
--- Description  : Top level Beaglewire FPGA interface for driving 64x64 LED matrix
+-- Description  : Top level Beaglewire FPGA interface for driving HUB75 LED matrices,
+--                one 64x64 panel by default
 --------------------------------------------------------------------------------
 library ieee;
     use ieee.std_logic_1164.all;
@@ -12,7 +13,40 @@ library ieee;
 
 entity led_matrix_fpga_top is
     generic (
-        DEBUG : boolean := false
+        DEBUG           : boolean := false;
+        -- Second frame buffer bank, the host writes the back bank and flips banks with R_CMD.
+        -- The HX4K only has the block RAM for it up to 32x32 (10 of its 20 EBRs), a 64x64
+        -- buffer already takes 18, so there R_CMD swap is just a wait for the frame end.
+        DOUBLE_BUFFER   : boolean := false;
+        -- 4 kbit block RAMs of the target part, the build stops if the buffers need more
+        PART_EBRS       : natural := 20;
+        -- GPMC configured for synchronous burst writes, the words are taken on the beat timing
+        -- of GPMC_BURST_LEN, GPMC_WR_FIRST_BEAT and GPMC_BEAT_CLKS with the address counting up
+        -- from the one given at the start of the access. Run tb/gpmc_sync_burst_tb.v with the
+        -- overlay's timing before enabling it
+        GPMC_BURST      : boolean := false;
+        -- BCM bit planes per colour, the frame buffer holds 3*BCM_BITS per pixel. Two 2048 deep
+        -- buffers only fit the 80 kbit of the HX4K block RAM at 6 bits, 7 and 8 need a larger part
+        BCM_BITS        : natural range 6 to 8 := 6;
+        -- Draw each frame as 2^SLICE_BITS sub-frames, the long bit planes are cut into that many
+        -- slices spread over the frame so they flicker at a multiple of the frame rate
+        SLICE_BITS      : natural range 0 to 3 := 0;
+        -- Palette mode, CTRL bit 1 makes the frame buffer hold 8 bit indices into a 256 entry
+        -- RGB565 palette that is looked up as the panel is scanned. Takes the two 4 kbit block
+        -- RAMs the 64x64 frame buffer leaves free on the HX4K and a clock of read latency
+        PALETTE         : boolean := false;
+        -- Panel geometry. Each panel is scanned as two halves of PANEL_HEIGHT/2 row pairs, and
+        -- PANEL_CHAIN panels daisy chained on one connector shift out as one panel PANEL_CHAIN
+        -- times as wide. PANEL_WIDTH*PANEL_CHAIN and PANEL_HEIGHT must be powers of 2 and the
+        -- frame buffer is PANEL_WIDTH*PANEL_CHAIN*PANEL_HEIGHT*3*BCM_BITS bits, so anything
+        -- over 64x64 needs a larger part than the HX4K
+        PANEL_WIDTH     : natural := 64;
+        PANEL_HEIGHT    : natural range 4 to 64 := 64;
+        PANEL_CHAIN     : natural range 1 to 15 := 1;
+        -- HUB75 clock in MHz. 25 and 50 are divided down from clk_100M, 33 and 40 come from the
+        -- PLL, which then clocks the whole matrix side. Most panels are specified to 25 or 30 MHz.
+        -- Uncomment the matching clk_matrix constraints in opallios_timing.sdc for 33 and 40
+        MATRIX_CLK_MHZ  : natural := 25
     );
     port (
         -- BeagleWire signals
@@ -47,7 +81,11 @@ architecture rtl of led_matrix_fpga_top is
     component gpmc_sync is
         generic (
             DATA_WIDTH : integer := 16;
-            ADDR_WIDTH : integer := 16
+            ADDR_WIDTH : integer := 16;
+            BURST      : integer := 0;
+            BURST_LEN  : integer := 8;
+            WR_FIRST_BEAT : integer := 1;
+            BEAT_CLKS  : integer := 1
         );
         port (
             clk         : in std_logic;
@@ -64,20 +102,33 @@ architecture rtl of led_matrix_fpga_top is
             cs          : out std_logic;
             address     : out std_logic_vector(ADDR_WIDTH-1 downto 0);
             data_out    : out std_logic_vector(DATA_WIDTH-1 downto 0);
-            data_in     : in  std_logic_vector(DATA_WIDTH-1 downto 0)
+            data_in     : in  std_logic_vector(DATA_WIDTH-1 downto 0);
+            wr_stb      : out std_logic;
+            wr_addr     : out std_logic_vector(ADDR_WIDTH-1 downto 0);
+            wr_data     : out std_logic_vector(DATA_WIDTH-1 downto 0);
+            wr_ovf      : out std_logic
         );
     end component;
 
     component matrix_interface is
         generic (
-            DEBUG : boolean := false
+            DEBUG : boolean := false;
+            BCM_BITS : natural range 6 to 8 := 6;
+            SLICE_BITS : natural range 0 to 3 := 0;
+            COL_BITS : natural := 6;
+            ROW_BITS : natural range 1 to 5 := 5;
+            CLK_DIV_2 : boolean := false;
+            RAM_PIPE : boolean := false;
+            FRAME_TICK : positive := 1000000
         );
         port (
             CLK             : in  std_logic;
             RSTn            : in  std_logic;
-            LED_Data_RGB_lo : in  std_logic_vector(17 downto 0); -- 18 bit color
-            LED_Data_RGB_hi : in  std_logic_vector(17 downto 0); -- 18 bit color
-            LED_RAM_Addr    : out std_logic_vector(10 downto 0); -- log2(64*64)
+            BCM_Unit        : in  std_logic_vector(7 downto 0);
+            Blank_Pad       : in  std_logic_vector(7 downto 0);
+            LED_Data_RGB_lo : in  std_logic_vector(3*BCM_BITS-1 downto 0);
+            LED_Data_RGB_hi : in  std_logic_vector(3*BCM_BITS-1 downto 0);
+            LED_RAM_Addr    : out std_logic_vector(ROW_BITS+COL_BITS-1 downto 0);
             R0              : out std_logic;
             G0              : out std_logic;
             B0              : out std_logic;
@@ -89,6 +140,8 @@ architecture rtl of led_matrix_fpga_top is
             BLANK           : out std_logic;
             LATCH           : out std_logic;
             Next_Frame      : out std_logic;
+            Frame_Done      : out std_logic;
+            Scan_Plane      : out std_logic_vector(2 downto 0);
             TP              : out std_logic_vector(7 downto 0)
         );
     end component;
@@ -109,43 +162,317 @@ architecture rtl of led_matrix_fpga_top is
         );
     end component;
 
+    component SB_PLL40_CORE is
+        generic (
+            FEEDBACK_PATH   : string := "SIMPLE";
+            PLLOUT_SELECT   : string := "GENCLK";
+            DIVR            : bit_vector(3 downto 0) := "0000";
+            DIVF            : bit_vector(6 downto 0) := "0000000";
+            DIVQ            : bit_vector(2 downto 0) := "000";
+            FILTER_RANGE    : bit_vector(2 downto 0) := "000"
+        );
+        port (
+            REFERENCECLK    : in  std_logic;
+            RESETB          : in  std_logic;
+            BYPASS          : in  std_logic;
+            EXTFEEDBACK     : in  std_logic;
+            DYNAMICDELAY    : in  std_logic_vector(7 downto 0);
+            LATCHINPUTVALUE : in  std_logic;
+            SCLK            : in  std_logic;
+            SDI             : in  std_logic;
+            SDO             : out std_logic;
+            PLLOUTCORE      : out std_logic;
+            PLLOUTGLOBAL    : out std_logic;
+            LOCK            : out std_logic
+        );
+    end component;
+
+    function clog2 (n : positive) return natural is
+        variable bits : natural := 0;
+    begin
+        while 2**bits < n loop
+            bits := bits + 1;
+        end loop;
+        return bits;
+    end function;
+
+    -- Frame buffer geometry. A pixel is addressed as half & row pair & column, the half selects
+    -- the lo or hi RAM and the rest is the RAM address, 1+5+6 bits for one 64x64 panel
+    constant COL_BITS       : natural := clog2(PANEL_WIDTH*PANEL_CHAIN);
+    constant ROW_BITS       : natural := clog2(PANEL_HEIGHT/2);
+    constant LED_ADDR_BITS  : natural := ROW_BITS + COL_BITS;
+    constant PIX_BITS       : natural := LED_ADDR_BITS + 1;
+
     -- S_ for start range, E_ for end range, R_ for register
-    constant S_REGS_ADDR    : std_logic_vector := x"0000"; -- map 16x16 register space
-    constant E_REGS_ADDR    : std_logic_vector := x"000F";
-    constant S_MATRIX_ADDR  : std_logic_vector := x"2000"; -- map 4096x18 to 8192x16
-    constant E_MATRIX_ADDR  : std_logic_vector := x"3FFF";
+    constant S_REGS_ADDR    : std_logic_vector := x"0000"; -- map 32x16 register space
+    constant E_REGS_ADDR    : std_logic_vector := x"001F";
+    constant S_PALETTE_ADDR : std_logic_vector := x"0100"; -- 256 RGB565 palette entries
+    constant E_PALETTE_ADDR : std_logic_vector := x"01FF";
+    constant S_STREAM_ADDR  : std_logic_vector := x"1000"; -- every write in here goes to R_STREAM_ADDR, which counts up
+    constant E_STREAM_ADDR  : std_logic_vector := x"1FFF";
+    constant S_MATRIX_ADDR  : std_logic_vector := x"2000"; -- map 2^PIX_BITS x 3*BCM_BITS to 2^(PIX_BITS+1) x 16
+    constant E_MATRIX_ADDR  : std_logic_vector := std_logic_vector(to_unsigned(16#2000# + 2**(PIX_BITS+1) - 1, 16));
+    constant E_MATRIX_565_ADDR : std_logic_vector := std_logic_vector(to_unsigned(16#2000# + 2**PIX_BITS - 1, 16)); -- one word per pixel in RGB565 format
+    constant E_MATRIX_PAL_ADDR : std_logic_vector := std_logic_vector(to_unsigned(16#2000# + 2**(PIX_BITS-1) - 1, 16)); -- two palette indices per word
+
+    -- Register file, offsets from S_REGS_ADDR
+    constant R_SCRATCH      : integer := 0; -- read/write, no function
+    constant R_CTRL         : integer := 1; -- read/write configuration
+    constant R_CMD          : integer := 2; -- write 1 to a bit to issue a command, reads back pending commands
+    constant R_STATUS       : integer := 3; -- read only
+    constant R_FRAME_CNT    : integer := 4; -- read only, frames drawn since reset, wraps
+    constant R_SCAN         : integer := 5; -- read only, row pair being drawn (4:0) and bit plane (10:8)
+    constant R_BCM_UNIT     : integer := 6; -- matrix clocks in the LSB plane period (7:0), 64 after reset
+    constant R_BLANK_PAD    : integer := 7; -- extra matrix clocks of blanking per plane (7:0), both apply from the next frame
+    -- words 8 and 9 are reserved
+    constant R_GEOMETRY     : integer := 10; -- read only, log2 panel width (3:0), log2 panel height (7:4),
+                                             -- panels chained (11:8) and BCM bits (15:12)
+    constant R_STREAM_ADDR  : integer := 11; -- word address the next write to the stream window goes to
+    constant R_SCROLL_X     : integer := 12; -- columns the picture is scrolled left, modulo the width, taken with R_SCROLL_Y
+    constant R_SCROLL_Y     : integer := 13; -- rows the picture is scrolled up, modulo the height, both from the next frame
+    constant R_FRAME_CRC    : integer := 14; -- read only, CRC of the frame words written since reset, CMD_SWAP or CMD_CRC_CLEAR
+    constant R_PERF         : integer := 16; -- read only, 32 bit performance counters from here on, low word first
+    -- Performance counters, free running from reset or CMD_PERF_CLEAR and wrapping
+    constant PERF_FRAMES    : integer := 0; -- frames scanned out
+    constant PERF_MEM_WR    : integer := 1; -- words taken into the frame buffer
+    constant PERF_REG_WR    : integer := 2; -- register writes
+    constant PERF_TEAR      : integer := 3; -- pixels written to the RAM row being read out of the displayed bank
+    constant PERF_CLOCKS    : integer := 4; -- clk_100M cycles
+    constant PERF_COUNTERS  : integer := 5;
+    -- R_CTRL bits
+    constant CTRL_RGB565    : integer := 0; -- frame memory takes one RGB565 word per pixel instead of two loose words
+    constant CTRL_PALETTE   : integer := 1; -- frame memory takes two palette indices per word, needs PALETTE
+    -- R_CMD bits
+    constant CMD_SWAP       : integer := 0; -- swap frame buffer banks at the end of the current frame
+    constant CMD_FRAME_ACK  : integer := 1; -- clear STATUS_FRAME
+    constant CMD_CRC_CLEAR  : integer := 2; -- restart R_FRAME_CRC
+    constant CMD_PERF_CLEAR : integer := 3; -- zero all the performance counters at once
+    -- R_STATUS bits
+    constant STATUS_BANK    : integer := 0; -- bank being displayed, the other one is written
+    constant STATUS_SWAP    : integer := 1; -- swap requested and not yet done
+    constant STATUS_FRAME   : integer := 2; -- sticky, a frame has finished since the last CMD_FRAME_ACK
+    constant STATUS_DOUBLE  : integer := 3; -- built with DOUBLE_BUFFER, there is a back bank to swap to
+    constant STATUS_WR_OVF  : integer := 4; -- sticky, GPMC burst words were lost, the beat timing doesn't match
+    constant STATUS_PALETTE : integer := 5; -- built with PALETTE, CTRL bit 1 selects indexed frames
+
+    -- build options as register bits
+    type t_Flag is array (boolean) of std_logic;
+    constant Flag : t_Flag := (
+        true  => '1',
+        false => '0'
+    );
+
+    -- Frame buffer address width, one more bit selects the bank when double buffered
+    type t_LED_RAM_Width is array (boolean) of natural;
+    constant LED_RAM_Width : t_LED_RAM_Width := (
+        true  => LED_ADDR_BITS + 1,
+        false => LED_ADDR_BITS
+    );
+
+    -- 4 kbit EBRs for a depth x width RAM, 256x16 down to 2048x2 per block
+    function Ebr_Count (depth : natural; width : natural) return natural is
+        variable d : natural := 256;
+        variable w : natural := 16;
+    begin
+        while (d < depth) and (d < 2048) loop
+            d := d * 2;
+            w := w / 2;
+        end loop;
+        return ((width + w - 1) / w) * ((depth + d - 1) / d);
+    end function;
+
+    constant EBRS_USED      : natural := 2 * Ebr_Count(2**LED_RAM_Width(DOUBLE_BUFFER), 3*BCM_BITS) +
+                                         2 * Ebr_Count(256, 16) * boolean'pos(PALETTE);
+
+    -- clocks from the RAM read address to the colour reaching the matrix interface
+    type t_RAM_Latency is array (boolean) of natural;
+    constant RAM_Latency : t_RAM_Latency := (
+        true  => 2,
+        false => 1
+    );
+
+    -- gpmc_sync takes an integer BURST parameter
+    type t_GPMC_Burst is array (boolean) of integer;
+    constant GPMC_Burst_Int : t_GPMC_Burst := (
+        true  => 1,
+        false => 0
+    );
+
+    -- Matrix side clocking for each MATRIX_CLK_MHZ. The HUB75 clock is a quarter of clk_100M at
+    -- 25 MHz and half of the matrix side clock otherwise. The PLL settings are for a 100 MHz
+    -- reference: fout = 100 MHz * (DIVF+1) / ((DIVR+1) * 2^DIVQ)
+    type t_Matrix_Clk is record
+        use_pll     : boolean;
+        clk_div_2   : boolean;
+        divr        : natural;
+        divf        : natural;
+        divq        : natural;
+        filter      : natural;
+        tick_100hz  : natural; -- matrix side clocks in 10 ms
+    end record;
+
+    function Matrix_Clk_Cfg (mhz : natural) return t_Matrix_Clk is
+    begin
+        case mhz is
+            when 25 => return (false, false, 0,  0, 0, 0, 1000000);
+            when 33 => return (true,  true,  2, 15, 3, 3,  666667); -- 66.67 MHz, 33.3 MHz PFD
+            when 40 => return (true,  true,  4, 31, 3, 2,  800000); -- 80 MHz, 20 MHz PFD
+            when 50 => return (false, true,  0,  0, 0, 0, 1000000);
+            when others =>
+                report "MATRIX_CLK_MHZ must be 25, 33, 40 or 50" severity failure;
+                return (false, false, 0, 0, 0, 0, 1000000);
+        end case;
+    end function;
+
+    constant MATRIX_CLK     : t_Matrix_Clk := Matrix_Clk_Cfg(MATRIX_CLK_MHZ);
+
+    -- RGB565 to 3*BCM_BITS, the 5 and 6 bit channels are widened by repeating their top bits
+    function Widen_565 (w : std_logic_vector(15 downto 0)) return std_logic_vector is
+        variable r : std_logic_vector(9 downto 0);
+        variable g : std_logic_vector(11 downto 0);
+        variable b : std_logic_vector(9 downto 0);
+    begin
+        r := w(15 downto 11) & w(15 downto 11);
+        g := w(10 downto 5) & w(10 downto 5);
+        b := w(4 downto 0) & w(4 downto 0);
+        return b(9 downto 10-BCM_BITS) & g(11 downto 12-BCM_BITS) & r(9 downto 10-BCM_BITS);
+    end function;
+
+    -- CRC-16/CCITT-FALSE, poly 0x1021 MSB first, of one more 16 bit word, same as the host's bridge_crc16
+    function Crc16_Word (crc : std_logic_vector(15 downto 0); w : std_logic_vector(15 downto 0)) return std_logic_vector is
+        variable c : std_logic_vector(15 downto 0);
+    begin
+        c := crc;
+        for i in 15 downto 0 loop
+            if (c(15) xor w(i)) = '1' then
+                c := (c(14 downto 0) & '0') xor x"1021";
+            else
+                c := c(14 downto 0) & '0';
+            end if;
+        end loop;
+        return c;
+    end function;
 
     -- GPMC constants
     constant GPMC_ADDR_WIDTH    : integer := 16;
     constant GPMC_DATA_WIDTH    : integer := 16;
     constant RAM_DEPTH          : integer := 2**GPMC_ADDR_WIDTH;
+    -- GPMC_BURST beat timing in gpmc_clk cycles, has to match the chip select config in the
+    -- BeagleWire overlay, see gpmc_sync
+    constant GPMC_BURST_LEN     : integer := 8; -- words per burst, a 128 bit store
+    constant GPMC_WR_FIRST_BEAT : integer := 1; -- from the end of the address phase to the first word
+    constant GPMC_BEAT_CLKS     : integer := 1; -- between words
     -- GPMC signals
     signal oen              : std_logic;
     signal wen              : std_logic;
     signal csn              : std_logic;
     signal gpmc_addr        : std_logic_vector(GPMC_ADDR_WIDTH-1 downto 0);
-    signal data_wr          : std_logic_vector(GPMC_DATA_WIDTH-1 downto 0);
+    signal wr_stb           : std_logic; -- one clock per written word
+    signal wr_addr          : std_logic_vector(GPMC_ADDR_WIDTH-1 downto 0);
+    signal wr_data          : std_logic_vector(GPMC_DATA_WIDTH-1 downto 0);
+    signal wr_ovf           : std_logic; -- burst beats were dropped
+    signal we_stream        : std_logic;
+    signal stream_ptr       : unsigned(GPMC_ADDR_WIDTH-1 downto 0);
+    signal mem_wr_addr      : std_logic_vector(GPMC_ADDR_WIDTH-1 downto 0); -- wr_addr with stream writes redirected
     signal data_rd          : std_logic_vector(GPMC_DATA_WIDTH-1 downto 0);
     
     -- reg ram signals
     signal oe               : std_logic;
-    signal we               : std_logic;
     signal we_regs          : std_logic;
     signal read_addr        : std_logic_vector(GPMC_ADDR_WIDTH-1 downto 0);
     signal raddr            : std_logic_vector(GPMC_ADDR_WIDTH-1 downto 0);
+    signal scratch_reg      : std_logic_vector(GPMC_DATA_WIDTH-1 downto 0);
+    signal ctrl_reg         : std_logic_vector(GPMC_DATA_WIDTH-1 downto 0);
+    signal bcm_unit_reg     : std_logic_vector(7 downto 0);
+    signal blank_pad_reg    : std_logic_vector(7 downto 0);
+    signal timing_tgl       : std_logic; -- flips on every write to a timing register or R_SCROLL_Y
+    signal scroll_x_wr      : std_logic_vector(COL_BITS-1 downto 0); -- R_SCROLL_X as written, waits for R_SCROLL_Y
+    signal scroll_x_reg     : std_logic_vector(COL_BITS-1 downto 0);
+    signal scroll_y_reg     : std_logic_vector(ROW_BITS downto 0);
+    signal cmd_rd           : std_logic_vector(GPMC_DATA_WIDTH-1 downto 0);
+    signal status_rd        : std_logic_vector(GPMC_DATA_WIDTH-1 downto 0);
+    signal swap_pending     : std_logic;
+    signal want_bank        : std_logic; -- bank to display from the next frame end
+    signal disp_bank        : std_logic;
+    signal Frame_Done       : std_logic;
+    signal frame_cnt        : unsigned(GPMC_DATA_WIDTH-1 downto 0);
+    signal geometry_rd      : std_logic_vector(GPMC_DATA_WIDTH-1 downto 0);
+    signal frame_crc        : std_logic_vector(GPMC_DATA_WIDTH-1 downto 0); -- over every word taken into the frame buffer
+    type t_Perf_Cnt is array (0 to PERF_COUNTERS-1) of unsigned(31 downto 0);
+    signal perf_cnt         : t_Perf_Cnt;
+    signal perf_inc         : std_logic_vector(PERF_COUNTERS-1 downto 0); -- count this clock
+    signal perf_clear       : std_logic;
+    signal we_tear          : std_logic;
+    signal wr_row           : std_logic_vector(ROW_BITS-1 downto 0); -- pixel row pair a frame write lands in
+    signal perf_rd          : unsigned(31 downto 0); -- counter addressed by raddr
+    signal frame_flag       : std_logic;
+    signal Scan_Plane       : std_logic_vector(2 downto 0);
+    signal scan_rd          : std_logic_vector(GPMC_DATA_WIDTH-1 downto 0);
     -- matrix LED ram signals
     signal we_matrix_lo     : std_logic;
     signal we_matrix_hi     : std_logic;
     signal we_matrix_buf    : std_logic;
-    signal LED_Wr_Addr      : std_logic_vector(10 downto 0); -- log2(64*64) bits
-    signal LED_Rd_Addr      : std_logic_vector(10 downto 0); -- log2(64*64) bits
-    signal LED_Data_RG_D    : std_logic_vector(11 downto 0);
-    signal LED_Data_RG_Q    : std_logic_vector(11 downto 0);
-    signal LED_Wr_Data_RGB  : std_logic_vector(17 downto 0); -- 18 bit color
-    signal LED_Data_RGB_lo  : std_logic_vector(17 downto 0); -- 18 bit color
-    signal LED_Data_RGB_hi  : std_logic_vector(17 downto 0); -- 18 bit color
-    signal LED_Data_RGB_lo_q: std_logic_vector(17 downto 0); -- register ram data to help timing
-    signal LED_Data_RGB_hi_q: std_logic_vector(17 downto 0); -- register ram data to help timing
+    signal we_matrix_px     : std_logic; -- last word of a pixel
+    signal matrix_hi        : std_logic; -- pixel is in the bottom half of the panel
+    signal matrix_off       : std_logic_vector(PIX_BITS downto 0); -- word offset into the frame window
+    signal fmt_565          : std_logic;
+    signal fmt_pal          : std_logic;
+    signal fmt_word         : std_logic; -- every word commits, one pixel in RGB565 or two indices
+    signal LED_Wr_Data_565  : std_logic_vector(3*BCM_BITS-1 downto 0);
+    signal LED_Wr_Data_Loose: std_logic_vector(3*BCM_BITS-1 downto 0);
+    signal LED_Wr_Addr      : std_logic_vector(LED_ADDR_BITS-1 downto 0); -- row pair & column
+    signal LED_Rd_Addr      : std_logic_vector(LED_ADDR_BITS-1 downto 0); -- row pair & column
+    signal LED_RAM_Wr_Addr  : std_logic_vector(LED_RAM_Width(DOUBLE_BUFFER)-1 downto 0); -- with bank select
+    signal LED_RAM_Rd_Addr  : std_logic_vector(LED_RAM_Width(DOUBLE_BUFFER)-1 downto 0); -- with bank select
+    signal LED_Data_RG      : std_logic_vector(2*BCM_BITS-1 downto 0);
+    signal LED_Wr_Data_RGB  : std_logic_vector(3*BCM_BITS-1 downto 0); -- 18 bit color for 6 planes
+    signal LED_Data_RGB_lo  : std_logic_vector(3*BCM_BITS-1 downto 0); -- 18 bit color for 6 planes
+    signal LED_Data_RGB_hi  : std_logic_vector(3*BCM_BITS-1 downto 0); -- 18 bit color for 6 planes
+    signal LED_Data_RGB_lo_q: std_logic_vector(3*BCM_BITS-1 downto 0); -- register ram data to help timing
+    signal LED_Data_RGB_hi_q: std_logic_vector(3*BCM_BITS-1 downto 0); -- register ram data to help timing
+    signal LED_Data_lo_mx   : std_logic_vector(3*BCM_BITS-1 downto 0); -- colour to shift out
+    signal LED_Data_hi_mx   : std_logic_vector(3*BCM_BITS-1 downto 0);
+    signal LED_Rd_Addr_fmt  : std_logic_vector(LED_ADDR_BITS-1 downto 0); -- pixel or index pair
+    signal LED_Rd_Addr_scr  : std_logic_vector(LED_ADDR_BITS-1 downto 0); -- LED_Rd_Addr with the scroll added
+    signal LED_Data_lo_out  : std_logic_vector(3*BCM_BITS-1 downto 0); -- colour for the top half
+    signal LED_Data_hi_out  : std_logic_vector(3*BCM_BITS-1 downto 0); -- and the bottom half
+    -- scroll signals, matrix side
+    signal scroll_x_mx      : std_logic_vector(COL_BITS-1 downto 0);
+    signal scroll_y_mx      : std_logic_vector(ROW_BITS downto 0);
+    signal scroll_x_q       : unsigned(COL_BITS-1 downto 0); -- taken at frame end
+    signal scroll_y_q       : unsigned(ROW_BITS downto 0);
+    signal scroll_row       : unsigned(ROW_BITS downto 0); -- picture row shown on the top half row
+    signal scroll_swap      : std_logic_vector(RAM_Latency(PALETTE)-1 downto 0); -- top half row comes from the hi RAM
+    signal scan_row_mx      : std_logic_vector(ROW_BITS-1 downto 0); -- frame buffer pixel row pair being read, scroll included
+    -- palette signals
+    signal we_palette       : std_logic;
+    signal pal_mode_sync    : std_logic_vector(1 downto 0); -- CTRL_PALETTE into clk_matrix
+    signal pal_sel_q        : std_logic; -- index of the pair in the RAM data
+    signal pal_idx_lo       : std_logic_vector(7 downto 0);
+    signal pal_idx_hi       : std_logic_vector(7 downto 0);
+    signal pal_data_lo      : std_logic_vector(15 downto 0);
+    signal pal_data_hi      : std_logic_vector(15 downto 0);
+
+    -- Matrix side, clocked by clk_matrix. Everything crossing from or to clk_100M goes through
+    -- the synchronizers below
+    signal clk_matrix       : std_logic;
+    signal pll_lock         : std_logic;
+    signal RSTn_matrix_sync : std_logic_vector(1 downto 0);
+    signal RSTn_matrix      : std_logic;
+    signal timing_sync      : std_logic_vector(2 downto 0); -- timing_tgl into clk_matrix
+    signal bcm_unit_mx      : std_logic_vector(7 downto 0);
+    signal blank_pad_mx     : std_logic_vector(7 downto 0);
+    signal want_bank_sync   : std_logic_vector(1 downto 0);
+    signal rd_bank          : std_logic; -- bank being read out, follows want_bank at frame end
+    signal Frame_Done_mx    : std_logic;
+    signal frame_tgl        : std_logic; -- flips at every frame end
+    signal frame_sync       : std_logic_vector(2 downto 0); -- frame_tgl into clk_100M
+    signal disp_bank_sync   : std_logic_vector(1 downto 0);
+    signal Scan_Plane_mx    : std_logic_vector(2 downto 0);
+    type t_Scan_Sync is array (0 to 1) of std_logic_vector(7 downto 0);
+    signal scan_sync        : t_Scan_Sync; -- plane and row for R_SCAN, only a status so not coherent
+    type t_Rd_Row_Sync is array (0 to 1) of std_logic_vector(ROW_BITS-1 downto 0);
+    signal rd_row_sync      : t_Rd_Row_Sync; -- pixel row pair being read, for PERF_TEAR, not coherent either
 
     -- Reset
     signal RSTn_counter    : std_logic_vector(15 downto 0) := (others => '0');
@@ -165,13 +492,25 @@ architecture rtl of led_matrix_fpga_top is
 
 begin
 
+    assert (2**COL_BITS = PANEL_WIDTH*PANEL_CHAIN) and (2**ROW_BITS = PANEL_HEIGHT/2)
+        report "PANEL_WIDTH*PANEL_CHAIN and PANEL_HEIGHT must be powers of 2" severity failure;
+    assert PIX_BITS <= 14
+        report "frame window doesn't fit the GPMC address space" severity failure;
+    assert EBRS_USED <= PART_EBRS
+        report "frame buffer and palette need " & integer'image(EBRS_USED) & " EBRs, the part has " &
+               integer'image(PART_EBRS) severity failure;
+
     --temporary output assignments
     led <= (others => '0'); 
 
     u_gpmc_sync: gpmc_sync
     generic map (
         DATA_WIDTH => GPMC_DATA_WIDTH,
-        ADDR_WIDTH => GPMC_ADDR_WIDTH
+        ADDR_WIDTH => GPMC_ADDR_WIDTH,
+        BURST      => GPMC_Burst_Int(GPMC_BURST),
+        BURST_LEN  => GPMC_BURST_LEN,
+        WR_FIRST_BEAT => GPMC_WR_FIRST_BEAT,
+        BEAT_CLKS  => GPMC_BEAT_CLKS
     )
     port map (
         clk         => clk_100M,
@@ -187,87 +526,437 @@ begin
         we          => wen,
         cs          => csn,
         address     => gpmc_addr,
-        data_out    => data_wr,
-        data_in     => data_rd
+        data_out    => open, -- writes come through wr_stb, wr_addr, wr_data
+        data_in     => data_rd,
+        wr_stb      => wr_stb,
+        wr_addr     => wr_addr,
+        wr_data     => wr_data,
+        wr_ovf      => wr_ovf
     );
 
     oe <= (not csn) and wen and (not oen); -- this may need to add a when for FPGA side writes
-    we <= (not csn) and (not wen) and oen; -- this may need to add a when for FPGA side writes
-    we_regs <= we when (gpmc_addr >= S_REGS_ADDR) and (gpmc_addr <= E_REGS_ADDR) else '0';
     read_addr <= (others => '0'); -- zero for now, FPGA side reads later 
     raddr <= gpmc_addr when oe = '1' else read_addr;
 
-    u_regs : dual_port_ram
-    generic map (
-        addr_width => 4, --16x16
-        data_width => 16
-    )
-    port map (
-        write_en    => we_regs,
-        waddr       => gpmc_addr(3 downto 0),
-        wclk        => clk_100M,
-        raddr       => raddr(3 downto 0),
-        rclk        => clk_100M,
-        din         => data_wr,
-        dout        => data_rd
-    );
+    -- all writes arrive as single clock strobes from gpmc_sync, one per word whether or not the GPMC bursts
+    we_regs <= wr_stb when (wr_addr >= S_REGS_ADDR) and (wr_addr <= E_REGS_ADDR) else '0';
+    -- the stream window ignores the address so the host can write it with any store width or burst
+    we_stream <= wr_stb when (wr_addr >= S_STREAM_ADDR) and (wr_addr <= E_STREAM_ADDR) else '0';
+    mem_wr_addr <= std_logic_vector(stream_ptr) when we_stream = '1' else wr_addr;
 
-    LED_Wr_Addr <= gpmc_addr(11 downto 1); -- divide by 2 to map 8192 to 4096
-    we_matrix_buf <= we when (gpmc_addr >= S_MATRIX_ADDR) and (gpmc_addr <= E_MATRIX_ADDR) else '0';
-    we_matrix_lo <= we_matrix_buf when (gpmc_addr(0) = '1') and (gpmc_addr(12) = '0') else '0'; -- only enable we when writing to the blue data reg, lo regs
-    we_matrix_hi <= we_matrix_buf when (gpmc_addr(0) = '1') and (gpmc_addr(12) = '1') else '0'; -- only enable we when writing to the blue data reg, hi regs
+    p_regs : process (clk_100M, RSTn)
+    begin
+        if RSTn = '0' then
+            scratch_reg <= (others => '0');
+            ctrl_reg <= (others => '0');
+            bcm_unit_reg <= std_logic_vector(to_unsigned(64,bcm_unit_reg'length));
+            blank_pad_reg <= (others => '0');
+            timing_tgl <= '0';
+            scroll_x_wr <= (others => '0');
+            scroll_x_reg <= (others => '0');
+            scroll_y_reg <= (others => '0');
+            stream_ptr <= unsigned(S_MATRIX_ADDR);
+            swap_pending <= '0';
+            want_bank <= '0';
+            frame_cnt <= (others => '0');
+            frame_flag <= '0';
+            frame_crc <= (others => '1');
+        elsif rising_edge(clk_100M) then
+            -- done once a frame has ended with the matrix side on the wanted bank
+            if (Frame_Done = '1') and (disp_bank = want_bank) then
+                swap_pending <= '0';
+            end if;
+            if we_stream = '1' then
+                stream_ptr <= stream_ptr + 1;
+            end if;
+            -- both words of a loose pixel, whichever way they came in
+            if we_matrix_buf = '1' then
+                frame_crc <= Crc16_Word(frame_crc, wr_data);
+            end if;
+            if we_regs = '1' then
+                case to_integer(unsigned(wr_addr(4 downto 0))) is
+                    when R_SCRATCH =>
+                        scratch_reg <= wr_data;
+                    when R_CTRL =>
+                        ctrl_reg <= wr_data;
+                    when R_BCM_UNIT =>
+                        bcm_unit_reg <= wr_data(7 downto 0);
+                        timing_tgl <= not timing_tgl;
+                    when R_BLANK_PAD =>
+                        blank_pad_reg <= wr_data(7 downto 0);
+                        timing_tgl <= not timing_tgl;
+                    when R_STREAM_ADDR =>
+                        stream_ptr <= unsigned(wr_data);
+                    when R_SCROLL_X =>
+                        scroll_x_wr <= wr_data(COL_BITS-1 downto 0);
+                    when R_SCROLL_Y =>
+                        -- both offsets go across together, so no frame is drawn with a new X and the old Y
+                        scroll_x_reg <= scroll_x_wr;
+                        scroll_y_reg <= wr_data(ROW_BITS downto 0);
+                        timing_tgl <= not timing_tgl;
+                    when R_CMD =>
+                        -- the matrix side switches to want_bank at the next frame end
+                        -- a swap starts the CRC of the next frame, the host checks it before swapping
+                        if (wr_data(CMD_SWAP) = '1') or (wr_data(CMD_CRC_CLEAR) = '1') then
+                            frame_crc <= (others => '1');
+                        end if;
+                        if (wr_data(CMD_SWAP) = '1') and (swap_pending = '0') then
+                            swap_pending <= '1';
+                            if DOUBLE_BUFFER then
+                                want_bank <= not disp_bank;
+                            end if;
+                        end if;
+                        if wr_data(CMD_FRAME_ACK) = '1' then
+                            frame_flag <= '0';
+                        end if;
+                    when others =>
+                end case;
+            end if;
+            -- after the acknowledge so a frame ending on the same clock isn't lost
+            if Frame_Done = '1' then
+                frame_cnt <= frame_cnt + 1;
+                frame_flag <= '1';
+            end if;
+        end if;
+    end process;
+
+    -- back from the matrix side
+    p_matrix_status_sync : process (clk_100M, RSTn)
+    begin
+        if RSTn = '0' then
+            frame_sync <= (others => '0');
+            disp_bank_sync <= (others => '0');
+            scan_sync <= (others => (others => '0'));
+            rd_row_sync <= (others => (others => '0'));
+        elsif rising_edge(clk_100M) then
+            frame_sync <= frame_sync(1 downto 0) & frame_tgl;
+            disp_bank_sync <= disp_bank_sync(0) & rd_bank;
+            scan_sync(0) <= Scan_Plane_mx & std_logic_vector(resize(unsigned(scan_row_mx),5));
+            scan_sync(1) <= scan_sync(0);
+            rd_row_sync(0) <= scan_row_mx;
+            rd_row_sync(1) <= rd_row_sync(0);
+        end if;
+    end process;
+    Frame_Done <= frame_sync(2) xor frame_sync(1);
+    disp_bank <= disp_bank_sync(1);
+    Scan_Plane <= scan_sync(1)(7 downto 5);
+
+    -- Performance counters. The host reads a counter's high word again after the low one and
+    -- retries if it moved, so there is no snapshot logic
+    perf_clear <= '1' when (we_regs = '1') and (to_integer(unsigned(wr_addr(4 downto 0))) = R_CMD) and
+                           (wr_data(CMD_PERF_CLEAR) = '1') else '0';
+    -- the host writes the back bank when double buffered, so only a single buffer can tear
+    -- compared as pixel rows, a palette word holds two pixels so its RAM address is half the pixel's
+    wr_row <= LED_Wr_Addr(LED_ADDR_BITS-2 downto COL_BITS-1) when fmt_pal = '1' else
+              LED_Wr_Addr(LED_ADDR_BITS-1 downto COL_BITS);
+    we_tear <= we_matrix_px when (wr_row = rd_row_sync(1)) and not DOUBLE_BUFFER else '0';
+    perf_inc <= (PERF_FRAMES => Frame_Done, PERF_MEM_WR => we_matrix_buf, PERF_REG_WR => we_regs,
+                 PERF_TEAR => we_tear, PERF_CLOCKS => '1');
+    perf_rd <= perf_cnt(to_integer(unsigned(raddr(3 downto 1))) mod PERF_COUNTERS);
+
+    p_perf : process (clk_100M, RSTn)
+    begin
+        if RSTn = '0' then
+            perf_cnt <= (others => (others => '0'));
+        elsif rising_edge(clk_100M) then
+            for i in 0 to PERF_COUNTERS-1 loop
+                if perf_clear = '1' then
+                    perf_cnt(i) <= (others => '0');
+                elsif perf_inc(i) = '1' then
+                    perf_cnt(i) <= perf_cnt(i) + 1;
+                end if;
+            end loop;
+        end if;
+    end process;
+
+    cmd_rd <= (CMD_SWAP => swap_pending, others => '0');
+    status_rd <= (STATUS_BANK => disp_bank, STATUS_SWAP => swap_pending, STATUS_FRAME => frame_flag,
+                  STATUS_DOUBLE => Flag(DOUBLE_BUFFER), STATUS_WR_OVF => wr_ovf,
+                  STATUS_PALETTE => Flag(PALETTE), others => '0');
+    scan_rd <= "00000" & Scan_Plane & "000" & scan_sync(1)(4 downto 0); -- frame buffer row pair being shifted out
+    geometry_rd <= std_logic_vector(to_unsigned(BCM_BITS,4)) & std_logic_vector(to_unsigned(PANEL_CHAIN,4)) &
+                   std_logic_vector(to_unsigned(clog2(PANEL_HEIGHT),4)) & std_logic_vector(to_unsigned(clog2(PANEL_WIDTH),4));
+
+    p_regs_rd : process (clk_100M) -- registered like a RAM read
+    begin
+        if rising_edge(clk_100M) then
+            case to_integer(unsigned(raddr(4 downto 0))) is
+                when R_SCRATCH => data_rd <= scratch_reg;
+                when R_CTRL    => data_rd <= ctrl_reg;
+                when R_CMD     => data_rd <= cmd_rd;
+                when R_STATUS  => data_rd <= status_rd;
+                when R_FRAME_CNT => data_rd <= std_logic_vector(frame_cnt);
+                when R_SCAN    => data_rd <= scan_rd;
+                when R_BCM_UNIT  => data_rd <= x"00" & bcm_unit_reg;
+                when R_BLANK_PAD => data_rd <= x"00" & blank_pad_reg;
+                when R_GEOMETRY => data_rd <= geometry_rd;
+                when R_STREAM_ADDR => data_rd <= std_logic_vector(stream_ptr);
+                when R_SCROLL_X => data_rd <= std_logic_vector(resize(unsigned(scroll_x_wr),GPMC_DATA_WIDTH));
+                when R_SCROLL_Y => data_rd <= std_logic_vector(resize(unsigned(scroll_y_reg),GPMC_DATA_WIDTH));
+                when R_FRAME_CRC => data_rd <= frame_crc;
+                when R_PERF to R_PERF + 2*PERF_COUNTERS - 1 =>
+                    if raddr(0) = '0' then
+                        data_rd <= std_logic_vector(perf_rd(15 downto 0));
+                    else
+                        data_rd <= std_logic_vector(perf_rd(31 downto 16));
+                    end if;
+                when others    => data_rd <= (others => '0');
+            end case;
+        end if;
+    end process;
+
+    -- loose format: 2 words per pixel, the RG word is held until the B word commits the pixel
+    -- RGB565 format: 1 word per pixel, every word commits a pixel
+    -- palette format: 1 word per 2 pixels, the index pair is stored as is in the lower half of the RAM
+    fmt_565 <= ctrl_reg(CTRL_RGB565) and not fmt_pal;
+    fmt_word <= fmt_565 or fmt_pal;
+    matrix_off <= std_logic_vector(resize(unsigned(mem_wr_addr) - unsigned(S_MATRIX_ADDR), PIX_BITS+1));
+    LED_Wr_Addr <= '0' & matrix_off(PIX_BITS-3 downto 0) when fmt_pal = '1' else
+                   matrix_off(PIX_BITS-2 downto 0) when fmt_565 = '1' else matrix_off(PIX_BITS-1 downto 1); -- divide by 2 when loose
+    matrix_hi <= matrix_off(PIX_BITS-2) when fmt_pal = '1' else
+                 matrix_off(PIX_BITS-1) when fmt_565 = '1' else matrix_off(PIX_BITS);
+    we_matrix_buf <= wr_stb when (mem_wr_addr >= S_MATRIX_ADDR) and (mem_wr_addr <= E_MATRIX_PAL_ADDR) else
+                     wr_stb when (mem_wr_addr >= S_MATRIX_ADDR) and (mem_wr_addr <= E_MATRIX_565_ADDR) and (fmt_pal = '0') else
+                     wr_stb when (mem_wr_addr >= S_MATRIX_ADDR) and (mem_wr_addr <= E_MATRIX_ADDR) and (fmt_word = '0') else '0';
+    we_matrix_px <= we_matrix_buf when (mem_wr_addr(0) = '1') or (fmt_word = '1') else '0';
+    we_matrix_lo <= we_matrix_px when matrix_hi = '0' else '0'; -- lo regs
+    we_matrix_hi <= we_matrix_px when matrix_hi = '1' else '0'; -- hi regs
 
     p_RG_reg: process (clk_100M)
     begin
         if rising_edge(clk_100M) then
-            LED_Data_RG_Q <= LED_Data_RG_D;
-            if ((we_matrix_buf = '1') and (gpmc_addr(0) = '0')) then
-                LED_Data_RG_D <= data_wr(15 downto 10) & data_wr(7 downto 2); -- divide R and G to lower and upper byte
+            if ((we_matrix_buf = '1') and (mem_wr_addr(0) = '0') and (fmt_word = '0')) then
+                LED_Data_RG <= wr_data(15 downto 16-BCM_BITS) & wr_data(7 downto 8-BCM_BITS); -- divide R and G to lower and upper byte, keep the top BCM_BITS
             end if;
         end if;
     end process;
 
-    LED_Wr_Data_RGB <= data_wr(7 downto 2) & LED_Data_RG_Q;
+    LED_Wr_Data_Loose <= wr_data(7 downto 8-BCM_BITS) & LED_Data_RG;
+    LED_Wr_Data_565 <= Widen_565(wr_data);
+    LED_Wr_Data_RGB <= std_logic_vector(resize(unsigned(wr_data),LED_Wr_Data_RGB'length)) when fmt_pal = '1' else
+                       LED_Wr_Data_565 when fmt_565 = '1' else LED_Wr_Data_Loose;
+
+    -- the host always writes the bank that isn't being displayed
+    g_double_buffer : if DOUBLE_BUFFER generate
+        LED_RAM_Wr_Addr <= (not disp_bank) & LED_Wr_Addr;
+        LED_RAM_Rd_Addr <= rd_bank & LED_Rd_Addr_fmt;
+    else generate
+        LED_RAM_Wr_Addr <= LED_Wr_Addr;
+        LED_RAM_Rd_Addr <= LED_Rd_Addr_fmt;
+    end generate;
 
     u_matrix_ram_lo : dual_port_ram -- store lower address data
     generic map (
-        addr_width => 11, --2096x18
-        data_width => 18
+        addr_width => LED_RAM_Width(DOUBLE_BUFFER), -- 2048x18 per bank for 64x64 and 6 planes
+        data_width => 3*BCM_BITS
     )
     port map (
         write_en    => we_matrix_lo,
-        waddr       => LED_Wr_Addr,
+        waddr       => LED_RAM_Wr_Addr,
         wclk        => clk_100M,
-        raddr       => LED_Rd_Addr,
-        rclk        => clk_100M,
+        raddr       => LED_RAM_Rd_Addr,
+        rclk        => clk_matrix,
         din         => LED_Wr_Data_RGB,
         dout        => LED_Data_RGB_lo
     );
 
     u_matrix_ram_hi : dual_port_ram -- store upper address data
     generic map (
-        addr_width => 11, --2096x18
-        data_width => 18
+        addr_width => LED_RAM_Width(DOUBLE_BUFFER), -- 2048x18 per bank for 64x64 and 6 planes
+        data_width => 3*BCM_BITS
     )
     port map (
         write_en    => we_matrix_hi,
-        waddr       => LED_Wr_Addr,
+        waddr       => LED_RAM_Wr_Addr,
         wclk        => clk_100M,
-        raddr       => LED_Rd_Addr,
-        rclk        => clk_100M,
+        raddr       => LED_RAM_Rd_Addr,
+        rclk        => clk_matrix,
         din         => LED_Wr_Data_RGB,
         dout        => LED_Data_RGB_hi
     );
 
+    -- Palette lookup on the matrix side. The RAM data is registered in both modes so the colour
+    -- always arrives a clock after the RAM read, the matrix interface is built with RAM_PIPE for it
+    g_palette : if PALETTE generate
+
+        fmt_pal <= ctrl_reg(CTRL_PALETTE);
+        we_palette <= wr_stb when (mem_wr_addr >= S_PALETTE_ADDR) and (mem_wr_addr <= E_PALETTE_ADDR) else '0';
+
+        -- one copy per half as the two halves are looked up at the same time
+        u_palette_lo : dual_port_ram
+        generic map (
+            addr_width => 8,
+            data_width => 16
+        )
+        port map (
+            write_en    => we_palette,
+            waddr       => mem_wr_addr(7 downto 0),
+            wclk        => clk_100M,
+            raddr       => pal_idx_lo,
+            rclk        => clk_matrix,
+            din         => wr_data,
+            dout        => pal_data_lo
+        );
+
+        u_palette_hi : dual_port_ram
+        generic map (
+            addr_width => 8,
+            data_width => 16
+        )
+        port map (
+            write_en    => we_palette,
+            waddr       => mem_wr_addr(7 downto 0),
+            wclk        => clk_100M,
+            raddr       => pal_idx_hi,
+            rclk        => clk_matrix,
+            din         => wr_data,
+            dout        => pal_data_hi
+        );
+
+        -- the mode only changes while the host sets up, a two flop copy is enough
+        p_palette_mx : process (clk_matrix)
+        begin
+            if rising_edge(clk_matrix) then
+                pal_mode_sync <= pal_mode_sync(0) & fmt_pal;
+                pal_sel_q <= LED_Rd_Addr_scr(0); -- column LSB picks the index, lines up with the RAM data
+                LED_Data_RGB_lo_q <= LED_Data_RGB_lo;
+                LED_Data_RGB_hi_q <= LED_Data_RGB_hi;
+            end if;
+        end process;
+
+        LED_Rd_Addr_fmt <= '0' & LED_Rd_Addr_scr(LED_ADDR_BITS-1 downto 1) when pal_mode_sync(1) = '1' else LED_Rd_Addr_scr;
+        pal_idx_lo <= LED_Data_RGB_lo(15 downto 8) when pal_sel_q = '1' else LED_Data_RGB_lo(7 downto 0);
+        pal_idx_hi <= LED_Data_RGB_hi(15 downto 8) when pal_sel_q = '1' else LED_Data_RGB_hi(7 downto 0);
+        LED_Data_lo_mx <= Widen_565(pal_data_lo) when pal_mode_sync(1) = '1' else LED_Data_RGB_lo_q;
+        LED_Data_hi_mx <= Widen_565(pal_data_hi) when pal_mode_sync(1) = '1' else LED_Data_RGB_hi_q;
+
+    else generate
+
+        fmt_pal <= '0';
+        we_palette <= '0';
+        LED_Rd_Addr_fmt <= LED_Rd_Addr_scr;
+        LED_Data_lo_mx <= LED_Data_RGB_lo;
+        LED_Data_hi_mx <= LED_Data_RGB_hi;
+
+    end generate;
+
+    -- Scrolling. Picture row r+y and row r+y+height/2 are shown on the row pair r, they sit at the
+    -- same address of the two RAMs, so the scroll adds to the RAM address and, when r+y has wrapped
+    -- into the bottom half, swaps the RAM outputs between the panel halves.
+    scroll_row <= resize(unsigned(LED_Rd_Addr(LED_ADDR_BITS-1 downto COL_BITS)),ROW_BITS+1) + scroll_y_q;
+    LED_Rd_Addr_scr <= std_logic_vector(scroll_row(ROW_BITS-1 downto 0)) &
+                       std_logic_vector(unsigned(LED_Rd_Addr(COL_BITS-1 downto 0)) + scroll_x_q);
+
+    p_scroll_swap : process (clk_matrix)
+    begin
+        if rising_edge(clk_matrix) then
+            scroll_swap <= std_logic_vector(shift_left(unsigned(scroll_swap),1)); -- delayed to line up with the data
+            scroll_swap(0) <= scroll_row(ROW_BITS);
+            -- R_SCAN gives the RAM row the host has to race, not the panel row
+            scan_row_mx <= std_logic_vector(scroll_row(ROW_BITS-1 downto 0));
+        end if;
+    end process;
+
+    LED_Data_lo_out <= LED_Data_hi_mx when scroll_swap(scroll_swap'high) = '1' else LED_Data_lo_mx;
+    LED_Data_hi_out <= LED_Data_lo_mx when scroll_swap(scroll_swap'high) = '1' else LED_Data_hi_mx;
+
+    -- matrix side clock
+    g_matrix_pll : if MATRIX_CLK.use_pll generate
+
+        u_matrix_pll : SB_PLL40_CORE
+        generic map (
+            FEEDBACK_PATH   => "SIMPLE",
+            PLLOUT_SELECT   => "GENCLK",
+            DIVR            => to_bitvector(std_logic_vector(to_unsigned(MATRIX_CLK.divr,4))),
+            DIVF            => to_bitvector(std_logic_vector(to_unsigned(MATRIX_CLK.divf,7))),
+            DIVQ            => to_bitvector(std_logic_vector(to_unsigned(MATRIX_CLK.divq,3))),
+            FILTER_RANGE    => to_bitvector(std_logic_vector(to_unsigned(MATRIX_CLK.filter,3)))
+        )
+        port map (
+            REFERENCECLK    => clk_100M,
+            RESETB          => '1',
+            BYPASS          => '0',
+            EXTFEEDBACK     => '0',
+            DYNAMICDELAY    => (others => '0'),
+            LATCHINPUTVALUE => '0',
+            SCLK            => '0',
+            SDI             => '0',
+            SDO             => open,
+            PLLOUTCORE      => open,
+            PLLOUTGLOBAL    => clk_matrix,
+            LOCK            => pll_lock
+        );
+
+    else generate
+
+        clk_matrix <= clk_100M;
+        pll_lock <= '1';
+
+    end generate;
+
+    -- matrix side reset, held until the PLL locks and released in step with clk_matrix
+    p_matrix_reset : process (clk_matrix, RSTn, pll_lock)
+    begin
+        if (RSTn = '0') or (pll_lock = '0') then
+            RSTn_matrix_sync <= (others => '0');
+        elsif rising_edge(clk_matrix) then
+            RSTn_matrix_sync <= RSTn_matrix_sync(0) & '1';
+        end if;
+    end process;
+    RSTn_matrix <= RSTn_matrix_sync(1);
+
+    -- The timing and scroll registers only change on host writes. The write toggle is synchronized and the
+    -- registers taken a clock after it arrives, by then they have been stable for two clk_matrix
+    p_matrix_cfg_sync : process (clk_matrix, RSTn_matrix)
+    begin
+        if RSTn_matrix = '0' then
+            timing_sync <= (others => '0');
+            bcm_unit_mx <= std_logic_vector(to_unsigned(64,bcm_unit_mx'length));
+            blank_pad_mx <= (others => '0');
+            scroll_x_mx <= (others => '0');
+            scroll_y_mx <= (others => '0');
+            scroll_x_q <= (others => '0');
+            scroll_y_q <= (others => '0');
+            want_bank_sync <= (others => '0');
+            rd_bank <= '0';
+            frame_tgl <= '0';
+        elsif rising_edge(clk_matrix) then
+            timing_sync <= timing_sync(1 downto 0) & timing_tgl;
+            if timing_sync(2) /= timing_sync(1) then
+                bcm_unit_mx <= bcm_unit_reg;
+                blank_pad_mx <= blank_pad_reg;
+                scroll_x_mx <= scroll_x_reg;
+                scroll_y_mx <= scroll_y_reg;
+            end if;
+            -- swap banks between frames so a frame is never shown half written
+            want_bank_sync <= want_bank_sync(0) & want_bank;
+            if Frame_Done_mx = '1' then
+                rd_bank <= want_bank_sync(1);
+                scroll_x_q <= unsigned(scroll_x_mx); -- a frame is drawn with one offset
+                scroll_y_q <= unsigned(scroll_y_mx);
+                frame_tgl <= not frame_tgl;
+            end if;
+        end if;
+    end process;
+
     u_matrix_if: matrix_interface
     generic map (
-        DEBUG => DEBUG
+        DEBUG => DEBUG,
+        BCM_BITS => BCM_BITS,
+        SLICE_BITS => SLICE_BITS,
+        COL_BITS => COL_BITS,
+        ROW_BITS => ROW_BITS,
+        CLK_DIV_2 => MATRIX_CLK.clk_div_2,
+        RAM_PIPE => PALETTE,
+        FRAME_TICK => MATRIX_CLK.tick_100hz
     )
     port map (
-        CLK             => CLK_100M,
-        RSTn            => RSTn,
-        LED_Data_RGB_lo => LED_Data_RGB_lo,
-        LED_Data_RGB_hi => LED_Data_RGB_hi,
+        CLK             => clk_matrix,
+        RSTn            => RSTn_matrix,
+        BCM_Unit        => bcm_unit_mx,
+        Blank_Pad       => blank_pad_mx,
+        LED_Data_RGB_lo => LED_Data_lo_out,
+        LED_Data_RGB_hi => LED_Data_hi_out,
         LED_RAM_Addr    => LED_Rd_Addr,
         R0              => R0_int,
         G0              => G0_int,
@@ -280,6 +969,8 @@ begin
         BLANK           => BLANK_int,
         LATCH           => LATCH_int,
         Next_Frame      => open,
+        Frame_Done      => Frame_Done_mx,
+        Scan_Plane      => Scan_Plane_mx,
         TP              => matrix_if_TP
     );
 
@@ -299,9 +990,9 @@ begin
     BLANK <= BLANK_int;
     LATCH <= LATCH_int;
 
-    P_tp_reg : process (CLK_100M)
+    P_tp_reg : process (clk_matrix)
     begin
-        if rising_edge(CLK_100M) then
+        if rising_edge(clk_matrix) then
             -- TP(0) <= Matrix_CLK_int;
             -- TP(1) <= R0_int;
             -- TP(2) <= G0_int;
@@ -4,20 +4,30 @@
 -- File         : matrix_control_sm.vhd
 -- Generated    : 07/08/2022
 --------------------------------------------------------------------------------
--- Description  : 64x64 LED matrix control state machine
+-- Description  : LED matrix control state machine, 64x64 by default
 --------------------------------------------------------------------------------
 library ieee;
     use ieee.std_logic_1164.all;
     use ieee.numeric_std.all;
 
 entity matrix_control_sm IS
+    generic (
+        BCM_BITS        : natural range 6 to 8 := 6; -- bit planes per colour
+        SLICE_BITS      : natural range 0 to 3 := 0; -- frame drawn as 2^SLICE_BITS sub-frames
+        COL_BITS        : natural := 6; -- log2 of the columns shifted per row
+        ROW_BITS        : natural range 1 to 5 := 5; -- log2 of the row pairs
+        FRAME_TICK      : positive := 1000000 -- CLK cycles per Next_Frame tick
+    );
     port (
         CLK             : in  std_logic;
         RSTn            : in  std_logic;
         Matrix_CLK_re   : in  std_logic;
         Matrix_CLK_fe   : in  std_logic;
-        LED_RAM_Addr    : out std_logic_vector(10 downto 0); -- log2(64*64/2)
+        BCM_Unit        : in  std_logic_vector(7 downto 0); -- matrix clocks in the LSB plane's period, taken at frame end
+        Blank_Pad       : in  std_logic_vector(7 downto 0); -- extra matrix clocks of blanking per plane, taken at frame end
+        LED_RAM_Addr    : out std_logic_vector(ROW_BITS+COL_BITS-1 downto 0); -- row pair & column
         Next_Frame      : out std_logic;
+        Frame_Done      : out std_logic; -- pulse when the last bit plane of the last row has been shown
         Matrix_CLK_Gate : out std_logic;
         Blank           : out std_logic;
         Latch           : out std_logic;
@@ -33,20 +43,56 @@ architecture rtl of matrix_control_sm is
     signal RGB_bit_count_d      : unsigned(2 downto 0) := (others => '0');
     signal RGB_bit_count_q      : unsigned(2 downto 0) := (others => '0');
 
-    type state_type is (Startup, Start_Shift_Data, Shift_Data_Out, Stop_Shift_Data, Latch_Data, Output_Enable, wait_BCM);
+    type state_type is (Startup, Start_Shift_Data, Shift_Data_Out, Stop_Shift_Data, wait_BCM, Latch_Data, Output_Enable);
     signal state : state_type;
 
     attribute syn_encoding : string;
     attribute syn_encoding of state : signal is "safe";
 
-    signal matrix_delay_cnt         : unsigned(11 downto 0) := (others => '0'); -- max value = 64*2^6=4096 = 12 bit
-    signal matrix_delay_cnt_d         : unsigned(11 downto 0) := (others => '0'); -- max value = 64*2^6=4096 = 12 bit
+    signal matrix_delay_cnt         : unsigned(COL_BITS-1 downto 0) := (others => '0'); -- columns shifted, max value = 2^COL_BITS-1
+    signal matrix_delay_cnt_d         : unsigned(COL_BITS-1 downto 0) := (others => '0'); -- columns shifted, max value = 2^COL_BITS-1
     signal rst_matrix_delay_cnt     : std_logic;
     signal incr_matrix_delay_cnt    : std_logic;
 
+    -- timing registers, only updated between frames so a frame is drawn with one set
+    signal bcm_unit_q   : unsigned(7 downto 0);
+    signal blank_pad_q  : unsigned(7 downto 0);
+    signal blank_cnt    : unsigned(7 downto 0);
+
+    -- BCM display timer, lights the latched plane for exactly its on time. Planes shorter than the
+    -- shift sit dark for the rest of it
+    signal bcm_on_time  : unsigned(BCM_BITS+7 downto 0); -- max value = 255*2^(BCM_BITS-1)
+    signal bcm_cnt      : unsigned(BCM_BITS+7 downto 0) := (others => '0');
+    signal bcm_done     : std_logic;
+
     signal incr_addr    : std_logic;
-    signal col_addr     : unsigned(5 downto 0) := (others => '0');
-    signal row_count    : unsigned(4 downto 0) := (others => '0');
+    signal col_addr     : unsigned(COL_BITS-1 downto 0) := (others => '0');
+    signal row_count    : unsigned(ROW_BITS-1 downto 0) := (others => '0');
+
+    -- Sliced planes. Every row is visited once per sub-frame. Planes of at least 2^SLICE_BITS
+    -- units are shown in each sub-frame for weight/2^SLICE_BITS, the lower ones for a single
+    -- unit in 2^plane of the sub-frames, so each plane keeps its on time per frame while the
+    -- long planes are broken up and repeated 2^SLICE_BITS times a frame
+    signal subframe     : natural range 0 to 2**SLICE_BITS-1 := 0;
+
+    function Plane_Shown (plane : natural; sub : natural) return boolean is
+    begin
+        if plane >= SLICE_BITS then
+            return true;
+        end if;
+        return (sub mod 2**(SLICE_BITS-plane)) = 0;
+    end function;
+
+    -- first plane from 'plane' up shown in sub-frame 'sub', BCM_BITS when the row is done
+    function Next_Plane (plane : natural; sub : natural) return natural is
+    begin
+        for p in 0 to BCM_BITS-1 loop
+            if (p >= plane) and Plane_Shown(p, sub) then
+                return p;
+            end if;
+        end loop;
+        return BCM_BITS;
+    end function;
 
 begin
 
@@ -58,7 +104,7 @@ begin
         elsif rising_edge(CLK) then
             Next_Frame <= '0';
             Frame_Timer <= Frame_Timer + 1;
-            if (Frame_Timer = to_unsigned(1000000-1,Frame_Timer'length)) then -- 100 Hz
+            if (Frame_Timer = to_unsigned(FRAME_TICK-1,Frame_Timer'length)) then
                 Frame_Timer <= (others => '0');
                 Next_Frame <= '1';
             end if;
@@ -82,7 +128,7 @@ begin
         end if;
     end process;
 
-    p_address_counter : process (CLK, RSTn) -- count address, range 0 to 2048, as we are using half the display for addressing
+    p_address_counter : process (CLK, RSTn) -- count address, range 0 to 2^(ROW_BITS+COL_BITS), as we are using half the display for addressing
     begin
         if RSTn = '0' then
             col_addr <= (others => '0');
@@ -96,7 +142,15 @@ begin
     end process;
     LED_RAM_Addr <= std_logic_vector(row_count) & std_logic_vector(col_addr);
 
+    -- on time of the plane about to be latched, binary weighted from the unit delay
+    bcm_on_time <= shift_left(resize(bcm_unit_q,bcm_on_time'length),to_integer(RGB_bit_count_q)-SLICE_BITS)
+                       when to_integer(RGB_bit_count_q) >= SLICE_BITS else
+                   resize(bcm_unit_q,bcm_on_time'length);
+    bcm_done <= '1' when bcm_cnt = 0 else '0';
+
     p_next_state : process(CLK, RSTn)
+        variable next_plane_v : natural range 0 to BCM_BITS;
+        variable next_sub_v   : natural range 0 to 2**SLICE_BITS-1;
     begin 
         if RSTn = '0' then
             state <= Startup;
@@ -104,12 +158,24 @@ begin
             RGB_bit_count_d <= (others => '0');
             RGB_bit_count_q <= (others => '0');
             row_count <= (others => '0');
+            subframe <= 0;
+            Frame_Done <= '0';
+            bcm_unit_q <= to_unsigned(64,bcm_unit_q'length);
+            blank_pad_q <= (others => '0');
+            blank_cnt <= (others => '0');
+            bcm_cnt <= (others => '0');
         elsif rising_edge(CLK) then
             RGB_bit_count_q <= RGB_bit_count_d;
+            Frame_Done <= '0';
             if (Matrix_CLK_re = '1') then
                 -- defaults
                 rst_matrix_delay_cnt <= '0';
 
+                -- the display timer counts down in every state, the shift does not add to the on time
+                if bcm_done = '0' then
+                    bcm_cnt <= bcm_cnt - 1;
+                end if;
+
                 -- state machine
                 case state is 
                     when Startup =>
@@ -117,27 +183,47 @@ begin
                     when Start_Shift_Data =>
                         state <= Shift_Data_Out;
                     when Shift_Data_Out =>  
-                        if matrix_delay_cnt = to_unsigned(62,matrix_delay_cnt'length) then
+                        if matrix_delay_cnt = to_unsigned(2**COL_BITS-2,matrix_delay_cnt'length) then
                             state <= Stop_Shift_Data;
                             rst_matrix_delay_cnt <= '1';
                         end if;
                     when Stop_Shift_Data =>
-                        state <= Latch_Data;
+                        state <= wait_BCM;
+                    when wait_BCM =>  
+                        -- the next plane is shifted in, latch it as soon as the current one has been shown for its time
+                        if bcm_done = '1' then
+                            state <= Latch_Data;
+                        end if;
                     when Latch_Data =>  
                         state <= Output_Enable;
                     when Output_Enable =>  
-                        state <= wait_BCM;
-                    when wait_BCM =>  
-                        if matrix_delay_cnt = shift_left(to_unsigned(64,matrix_delay_cnt'length),to_integer(RGB_bit_count_q))-64 then -- lsh +6 for 64x to make the 64 clock shift period the unit delay (approx)
-                            if RGB_bit_count_q = to_unsigned(5,RGB_bit_count_q'length) then
-                                state <= Start_Shift_Data;
-                                RGB_bit_count_d <= (others => '0');
+                        blank_cnt <= blank_cnt + 1;
+                        if blank_cnt = blank_pad_q then
+                            -- start showing the latched plane and move on to shifting the next one
+                            state <= Start_Shift_Data;
+                            blank_cnt <= (others => '0');
+                            bcm_cnt <= bcm_on_time;
+                            next_plane_v := Next_Plane(to_integer(RGB_bit_count_q)+1, subframe);
+                            if next_plane_v = BCM_BITS then
                                 row_count <= row_count + 1;
+                                next_sub_v := subframe;
+                                if row_count = 2**row_count'length - 1 then -- last row pair of the sub-frame
+                                    if subframe = 2**SLICE_BITS-1 then
+                                        next_sub_v := 0;
+                                    else
+                                        next_sub_v := subframe + 1;
+                                    end if;
+                                    subframe <= next_sub_v;
+                                    if next_sub_v = 0 then -- nothing more is read from this frame
+                                        Frame_Done <= '1';
+                                        bcm_unit_q <= unsigned(BCM_Unit);
+                                        blank_pad_q <= unsigned(Blank_Pad);
+                                    end if;
+                                end if;
+                                RGB_bit_count_d <= to_unsigned(Next_Plane(0, next_sub_v),RGB_bit_count_d'length);
                             else
-                                state <= Start_Shift_Data;
-                                RGB_bit_count_d <= RGB_bit_count_q + 1; -- roll back over when done
+                                RGB_bit_count_d <= to_unsigned(next_plane_v,RGB_bit_count_d'length);
                             end if;
-                            rst_matrix_delay_cnt <= '1';
                         end if;
                     when others =>
                         state <= Start_Shift_Data;
@@ -146,11 +232,11 @@ begin
         end if;
     end process;
 
-    p_state_signals : process(state)
+    p_state_signals : process(state, bcm_done)
     begin 
         -- defaults
         Latch <= '0';
-        Blank <= '0';
+        Blank <= bcm_done; -- dark once the plane has had its time, until the next one is latched
         incr_addr <= '0';
         incr_matrix_delay_cnt <= '0';
         Matrix_CLK_Gate <= '0';
@@ -171,7 +257,6 @@ begin
             when Output_Enable =>  
                 Blank <= '1';
             when wait_BCM =>  
-                incr_matrix_delay_cnt <= '1';
             when others => 
         end case; 
     end process;
@@ -4,7 +4,7 @@
 -- File         : matrix_interface.vhd
 -- Generated    : 07/06/2022
 --------------------------------------------------------------------------------
--- Description  : 64x64 LED matrix interface module with HUB75 interface
+-- Description  : LED matrix interface module with HUB75 interface, 64x64 by default
 --------------------------------------------------------------------------------
 library ieee;
     use ieee.std_logic_1164.all;
@@ -12,14 +12,23 @@ library ieee;
 
 entity matrix_interface IS
     generic (
-        DEBUG : boolean := false
+        DEBUG : boolean := false;
+        BCM_BITS : natural range 6 to 8 := 6; -- bits per colour channel
+        SLICE_BITS : natural range 0 to 3 := 0; -- frame drawn as 2^SLICE_BITS sub-frames
+        COL_BITS : natural := 6; -- log2 of the columns shifted per row, all chained panels
+        ROW_BITS : natural range 1 to 5 := 5; -- log2 of the row pairs, 5 for 1/32 scan
+        CLK_DIV_2 : boolean := false; -- matrix clock is CLK/2 instead of CLK/4, ignored in DEBUG
+        RAM_PIPE : boolean := false; -- LED_Data_RGB arrives a clock after the RAM read
+        FRAME_TICK : positive := 1000000 -- CLK cycles per Next_Frame tick, 100 Hz at 100 MHz
     );
     port (
         CLK             : in  std_logic;
         RSTn            : in  std_logic;
-        LED_Data_RGB_lo : in  std_logic_vector(17 downto 0); -- 18 bit color
-        LED_Data_RGB_hi : in  std_logic_vector(17 downto 0); -- 18 bit color
-        LED_RAM_Addr    : out std_logic_vector(10 downto 0); -- log2(64*64)/2
+        BCM_Unit        : in  std_logic_vector(7 downto 0);
+        Blank_Pad       : in  std_logic_vector(7 downto 0);
+        LED_Data_RGB_lo : in  std_logic_vector(3*BCM_BITS-1 downto 0); -- B & G & R, 18 bit color for 6 planes
+        LED_Data_RGB_hi : in  std_logic_vector(3*BCM_BITS-1 downto 0); -- B & G & R, 18 bit color for 6 planes
+        LED_RAM_Addr    : out std_logic_vector(ROW_BITS+COL_BITS-1 downto 0); -- row pair & column
         R0              : out std_logic;
         G0              : out std_logic;
         B0              : out std_logic;
@@ -31,6 +40,8 @@ entity matrix_interface IS
         BLANK           : out std_logic;
         LATCH           : out std_logic;
         Next_Frame      : out std_logic;
+        Frame_Done      : out std_logic;
+        Scan_Plane      : out std_logic_vector(2 downto 0); -- BCM bit plane being shifted out
         TP              : out std_logic_vector(7 downto 0)
     );
 end matrix_interface;
@@ -38,13 +49,23 @@ end matrix_interface;
 architecture rtl of matrix_interface is
 
     component matrix_control_sm is
+        generic (
+            BCM_BITS        : natural range 6 to 8 := 6;
+            SLICE_BITS      : natural range 0 to 3 := 0;
+            COL_BITS        : natural := 6;
+            ROW_BITS        : natural range 1 to 5 := 5;
+            FRAME_TICK      : positive := 1000000
+        );
         port (
             CLK             : in  std_logic;
             RSTn            : in  std_logic;
             Matrix_CLK_re   : in  std_logic;
             Matrix_CLK_fe   : in  std_logic;
-            LED_RAM_Addr    : out std_logic_vector(10 downto 0); -- log2(64*64/2)
+            BCM_Unit        : in  std_logic_vector(7 downto 0);
+            Blank_Pad       : in  std_logic_vector(7 downto 0);
+            LED_RAM_Addr    : out std_logic_vector(ROW_BITS+COL_BITS-1 downto 0);
             Next_Frame      : out std_logic;
+            Frame_Done      : out std_logic;
             Matrix_CLK_Gate : out std_logic;
             Blank           : out std_logic;
             Latch           : out std_logic;
@@ -59,7 +80,13 @@ architecture rtl of matrix_interface is
         false => 2
     );
     signal Clk_Div_Count    : unsigned(CLK_Div_Length(DEBUG)-1 downto 0) := (others => '0'); -- 25 MHz in non-debug, 12.5MHz in debug
+    signal Clk_Div_2        : std_logic := '0';
     signal Matrix_CLK_Gate  : std_logic;
+    -- SM outputs as they go out with the pixel data
+    signal Matrix_CLK_Gate_al : std_logic;
+    signal Latch_al         : std_logic;
+    signal Blank_al         : std_logic;
+    signal Row_Addr_al      : std_logic_vector(4 downto 0); -- padded to the 5 HUB75 address lines
     signal Matrix_CLK_re    : std_logic;
     signal Matrix_CLK_fe    : std_logic;
     signal RGB_bit_count    : std_logic_vector(2 downto 0) := (others => '0');
@@ -77,12 +104,12 @@ architecture rtl of matrix_interface is
     signal R1_re : std_logic;
     signal G1_re : std_logic;
     signal B1_re : std_logic;
-    signal LED_Data_R0 : std_logic_vector(5 downto 0);
-    signal LED_Data_G0 : std_logic_vector(5 downto 0);
-    signal LED_Data_B0 : std_logic_vector(5 downto 0);
-    signal LED_Data_R1 : std_logic_vector(5 downto 0);
-    signal LED_Data_G1 : std_logic_vector(5 downto 0);
-    signal LED_Data_B1 : std_logic_vector(5 downto 0);
+    signal LED_Data_R0 : std_logic_vector(BCM_BITS-1 downto 0);
+    signal LED_Data_G0 : std_logic_vector(BCM_BITS-1 downto 0);
+    signal LED_Data_B0 : std_logic_vector(BCM_BITS-1 downto 0);
+    signal LED_Data_R1 : std_logic_vector(BCM_BITS-1 downto 0);
+    signal LED_Data_G1 : std_logic_vector(BCM_BITS-1 downto 0);
+    signal LED_Data_B1 : std_logic_vector(BCM_BITS-1 downto 0);
 
     signal TP_SM : std_logic_vector(7 downto 0);
 
@@ -102,7 +129,7 @@ begin
                 if Clk_Div_Count = "110" then -- 1 before 111 as 1 clk delay
                     Matrix_CLK_fe <= '1';
                 end if;
-                if Matrix_CLK_Gate = '1' then
+                if Matrix_CLK_Gate_al = '1' then
                     if Clk_Div_Count = "011" then
                         Matrix_CLK <= '1';
                     end if;
@@ -113,6 +140,27 @@ begin
             end if;
         end process;
 
+    elsif CLK_DIV_2 generate
+
+        p_clk_div : process (CLK)
+        begin
+            if rising_edge(CLK) then
+                Clk_Div_2 <= not Clk_Div_2;
+                Matrix_CLK_re <= '0';
+                Matrix_CLK_fe <= '0';
+                if Clk_Div_2 = '1' then -- strobes alternate, each 1 clk ahead of its edge
+                    Matrix_CLK_re <= '1';
+                else
+                    Matrix_CLK_fe <= '1';
+                end if;
+                if (Matrix_CLK_Gate_al = '1') and (Clk_Div_2 = '0') then
+                    Matrix_CLK <= '1';
+                else
+                    Matrix_CLK <= '0';
+                end if;
+            end if;
+        end process;
+
     else generate
 
         p_clk_div : process (CLK)
@@ -127,7 +175,7 @@ begin
                 if Clk_Div_Count = "10" then -- 1 before 11 as 1 clk delay
                     Matrix_CLK_fe <= '1';
                 end if;
-                if Matrix_CLK_Gate = '1' then
+                if Matrix_CLK_Gate_al = '1' then
                     if Clk_Div_Count = "01" then
                         Matrix_CLK <= '1';
                     end if;
@@ -141,13 +189,23 @@ begin
     end generate;
 
     u_matrix_sm : matrix_control_sm
+    generic map (
+        BCM_BITS        => BCM_BITS,
+        SLICE_BITS      => SLICE_BITS,
+        COL_BITS        => COL_BITS,
+        ROW_BITS        => ROW_BITS,
+        FRAME_TICK      => FRAME_TICK
+    )
     port map (
         CLK             => CLK,
         RSTn            => RSTn,
         Matrix_CLK_re   => Matrix_CLK_re,
         Matrix_CLK_fe   => Matrix_CLK_fe,
+        BCM_Unit        => BCM_Unit,
+        Blank_Pad       => Blank_Pad,
         LED_RAM_Addr    => LED_RAM_Addr_int,
         Next_Frame      => Next_Frame,
+        Frame_Done      => Frame_Done,
         Matrix_CLK_Gate => Matrix_CLK_Gate,
         Blank           => Blank_int,
         Latch           => Latch_int,
@@ -155,12 +213,38 @@ begin
         TP              => TP_SM
     );
 
-    LED_Data_R0 <= LED_Data_RGB_lo( 5 downto  0);
-    LED_Data_G0 <= LED_Data_RGB_lo(11 downto  6);
-    LED_Data_B0 <= LED_Data_RGB_lo(17 downto 12);
-    LED_Data_R1 <= LED_Data_RGB_hi( 5 downto  0);
-    LED_Data_G1 <= LED_Data_RGB_hi(11 downto  6);
-    LED_Data_B1 <= LED_Data_RGB_hi(17 downto 12);
+    LED_Data_R0 <= LED_Data_RGB_lo(  BCM_BITS-1 downto          0);
+    LED_Data_G0 <= LED_Data_RGB_lo(2*BCM_BITS-1 downto   BCM_BITS);
+    LED_Data_B0 <= LED_Data_RGB_lo(3*BCM_BITS-1 downto 2*BCM_BITS);
+    LED_Data_R1 <= LED_Data_RGB_hi(  BCM_BITS-1 downto          0);
+    LED_Data_G1 <= LED_Data_RGB_hi(2*BCM_BITS-1 downto   BCM_BITS);
+    LED_Data_B1 <= LED_Data_RGB_hi(3*BCM_BITS-1 downto 2*BCM_BITS);
+
+    -- At CLK/2, or CLK/4 with a pipelined RAM read, the data for an address only arrives at the
+    -- falling edge of the next matrix clock, so the controls shifted out with it are held back by
+    -- one matrix clock to match
+    g_align : if (CLK_DIV_2 or RAM_PIPE) and not DEBUG generate
+
+        p_align : process (CLK)
+        begin
+            if rising_edge(CLK) then
+                if Matrix_CLK_re = '1' then
+                    Matrix_CLK_Gate_al <= Matrix_CLK_Gate;
+                    Latch_al <= Latch_int;
+                    Blank_al <= Blank_int;
+                    Row_Addr_al <= std_logic_vector(resize(unsigned(LED_RAM_Addr_int(ROW_BITS+COL_BITS-1 downto COL_BITS)),5));
+                end if;
+            end if;
+        end process;
+
+    else generate
+
+        Matrix_CLK_Gate_al <= Matrix_CLK_Gate;
+        Latch_al <= Latch_int;
+        Blank_al <= Blank_int;
+        Row_Addr_al <= std_logic_vector(resize(unsigned(LED_RAM_Addr_int(ROW_BITS+COL_BITS-1 downto COL_BITS)),5));
+
+    end generate;
 
     p_shift_data : process (CLK, Matrix_CLK_fe)
     begin
@@ -171,16 +255,17 @@ begin
             R1 <= LED_Data_R1(to_integer(unsigned(RGB_bit_count)));
             G1 <= LED_Data_G1(to_integer(unsigned(RGB_bit_count)));
             B1 <= LED_Data_B1(to_integer(unsigned(RGB_bit_count)));
-            LATCH <= Latch_int;
-            BLANK <= Blank_int;
-            if Blank_int = '1' then
-                Matrix_Addr <= LED_RAM_Addr_int(10 downto 6);
-                TP(4 downto 0) <= LED_RAM_Addr_int(10 downto 6);
+            LATCH <= Latch_al;
+            BLANK <= Blank_al;
+            if Blank_al = '1' then
+                Matrix_Addr <= Row_Addr_al;
+                TP(4 downto 0) <= Row_Addr_al;
             end if;
         end if;
     end process;
 
     LED_RAM_Addr <= LED_RAM_Addr_int;
+    Scan_Plane <= RGB_bit_count;
     TP(7 downto 5) <= TP_SM(2 downto 0);
 
 end architecture;
\ No newline at end of file
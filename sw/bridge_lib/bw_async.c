@@ -0,0 +1,112 @@
+#define _POSIX_C_SOURCE 200809L
+#include <poll.h>
+#include <sys/eventfd.h>
+#include "bw_async.h"
+
+static void *bridge_async_worker(void *arg) {
+	struct bridge_async *as = arg;
+	struct bridge_xfer *xfer;
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&as->lock);
+	while (1) {
+		while (!as->head && !as->stop)
+			pthread_cond_wait(&as->cond, &as->lock);
+		if (!as->head)
+			break;	/* stopped and drained */
+		xfer = as->head;
+		as->head = xfer->next;
+		if (!as->head)
+			as->tail = NULL;
+		pthread_mutex_unlock(&as->lock);
+
+		if (xfer->sh) {
+			xfer->written = set_fpga_mem_delta(as->br, xfer->sh,
+							   xfer->source);
+		} else if (set_fpga_mem(as->br, xfer->reg_addr, xfer->source,
+					xfer->reg_num) < 0) {
+			xfer->written = 0;	/* outside the window */
+		} else {
+			xfer->written = xfer->reg_num;
+		}
+		/* xfer may be reused as soon as done() runs */
+		if (xfer->done)
+			xfer->done(xfer);
+		if (write(as->event_fd, &one, sizeof(one)) < 0)
+			perror("bridge_async eventfd");
+
+		pthread_mutex_lock(&as->lock);
+	}
+	pthread_mutex_unlock(&as->lock);
+
+	return NULL;
+}
+
+int bridge_async_init(struct bridge_async *as, struct bridge *br) {
+	as->br = br;
+	as->head = NULL;
+	as->tail = NULL;
+	as->stop = 0;
+	as->event_fd = eventfd(0, EFD_CLOEXEC);
+	if (as->event_fd < 0)
+		return -errno;
+	pthread_mutex_init(&as->lock, NULL);
+	pthread_cond_init(&as->cond, NULL);
+	if (pthread_create(&as->thread, NULL, bridge_async_worker, as)) {
+		close(as->event_fd);
+		return -EAGAIN;
+	}
+
+	return 0;
+}
+
+/* Finish the queued transfers and stop the worker */
+void bridge_async_close(struct bridge_async *as) {
+	pthread_mutex_lock(&as->lock);
+	as->stop = 1;
+	pthread_cond_signal(&as->cond);
+	pthread_mutex_unlock(&as->lock);
+	pthread_join(as->thread, NULL);
+
+	pthread_cond_destroy(&as->cond);
+	pthread_mutex_destroy(&as->lock);
+	close(as->event_fd);
+}
+
+/* Queue xfer, its source must stay untouched until it completes */
+void bridge_async_submit(struct bridge_async *as, struct bridge_xfer *xfer) {
+	xfer->next = NULL;
+	xfer->written = 0;
+
+	pthread_mutex_lock(&as->lock);
+	if (as->tail)
+		as->tail->next = xfer;
+	else
+		as->head = xfer;
+	as->tail = xfer;
+	pthread_cond_signal(&as->cond);
+	pthread_mutex_unlock(&as->lock);
+}
+
+/* Readable whenever transfers have completed since the last wait */
+int bridge_async_fd(struct bridge_async *as) {
+	return as->event_fd;
+}
+
+/*
+ * Wait up to timeout_ms (-1 forever, 0 to poll) for completions. Returns how
+ * many transfers completed since the last call, 0 on timeout.
+ */
+int bridge_async_wait(struct bridge_async *as, int timeout_ms) {
+	struct pollfd pfd = { .fd = as->event_fd, .events = POLLIN };
+	uint64_t count;
+	int ret;
+
+	ret = poll(&pfd, 1, timeout_ms);
+	if (ret <= 0)
+		return ret < 0 ? -errno : 0;
+	if (read(as->event_fd, &count, sizeof(count)) < 0)
+		return -errno;
+
+	return count;
+}
@@ -1,16 +1,62 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime, ftruncate
+#include <stdlib.h>
+#include <string.h>
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define BW_BRIDGE_NEON 1
+#define BW_WIDE_ALIGN 0xf	/* 128 bit stores */
+#else
+#define BW_WIDE_ALIGN 0x3	/* 32 bit stores */
+#endif
 #include "bw_bridge.h"
 
+static uint64_t bridge_now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int bridge_use_sim(const char **path) {
+	const char *env = getenv(BW_BRIDGE_SIM_ENV);
+
+	*path = BW_BRIDGE_SIM_FILE;
+	if (env && *env && strcmp(env, "0") && strcmp(env, "1"))
+		*path = env;
+#ifdef BW_BRIDGE_SIM
+	return 1;
+#else
+	return env && *env && strcmp(env, "0");
+#endif
+}
+
 int bridge_init(struct bridge *br, uint32_t mem_address, uint32_t mem_size) {
 	uint32_t page_mask;
 	uint32_t page_size;
+	const char *sim_path;
 
 	page_size = sysconf(_SC_PAGESIZE);
 	br->alloc_mem_size = (((mem_size / page_size) + 1) * page_size);
 	page_mask = (page_size - 1);
+	br->sim = bridge_use_sim(&sim_path);
+	br->wr_crc = BW_CRC_INIT;
+	bridge_reset_stats(br);
 
-	br->mem_dev = open("/dev/mem", O_RDWR | O_SYNC);
-	if (br->mem_dev < 0)
-		return -EPERM;
+	if (br->sim) {
+		/* file backed window, the FPGA offset is meaningless here */
+		br->mem_dev = open(sim_path, O_RDWR | O_CREAT, 0666);
+		if (br->mem_dev < 0)
+			return -EPERM;
+		if (ftruncate(br->mem_dev, br->alloc_mem_size) < 0) {
+			close(br->mem_dev);
+			return -ENOMEM;
+		}
+		mem_address &= page_mask;
+	} else {
+		br->mem_dev = open("/dev/mem", O_RDWR | O_SYNC);
+		if (br->mem_dev < 0)
+			return -EPERM;
+	}
 
 	br->mem_pointer = mmap(NULL,
 		               br->alloc_mem_size,
@@ -35,26 +81,477 @@ void bridge_close(struct bridge *br) {
 	close(br->mem_dev);
 }
 
-uint16_t get_word(struct bridge *br, uint16_t reg_addr) {
+uint16_t get_word(struct bridge *br, uint32_t reg_addr) {
 	return *(uint16_t *)(br->virt_addr + reg_addr);
 }
 
-void set_word(struct bridge *br, uint16_t reg_addr, uint16_t word) {
+void set_word(struct bridge *br, uint32_t reg_addr, uint16_t word) {
 	*(uint16_t *)(br->virt_addr + reg_addr) = word;
 }
 
-void set_fpga_mem(struct bridge *br, uint16_t reg_addr, const void* source,
-		     size_t reg_num) {
-	unsigned int c;
-	uint16_t *usrc = (uint16_t *)source;
-	for (c = 0; c < reg_num; c++)
-		*(uint16_t *)(br->virt_addr + reg_addr + c*2) = usrc[c];
+/* reg_num words from byte address reg_addr stay inside the mapped window */
+static int bridge_in_window(uint32_t reg_addr, size_t reg_num) {
+	return reg_addr <= BW_BRIDGE_MEM_SIZE &&
+	       reg_num <= (BW_BRIDGE_MEM_SIZE - reg_addr) / 2;
+}
+
+/* CRC-16/CCITT-FALSE a nibble at a time, the FPGA does a word per clock */
+static const uint16_t bridge_crc_nibble[16] = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+	0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+};
+
+static uint16_t bridge_crc16(uint16_t crc, const uint16_t *src, size_t num) {
+	size_t c;
+	int shift;
+
+	for (c = 0; c < num; c++)
+		for (shift = 12; shift >= 0; shift -= 4)
+			crc = (crc << 4) ^ bridge_crc_nibble[(crc >> 12) ^
+				((src[c] >> shift) & 0xf)];
+
+	return crc;
+}
+
+/*
+ * Copy words into the window with the widest stores that stay aligned, the
+ * GPMC splits each one into back to back 16 bit accesses, or a burst when it
+ * is configured for them. source only needs 16 bit alignment.
+ */
+static void bridge_write_words(volatile uint16_t *dst, const uint16_t *src,
+			       size_t num) {
+	size_t c = 0;
+	uint32_t pair;
+
+	for (; c < num && ((uintptr_t)&dst[c] & BW_WIDE_ALIGN); c++)
+		dst[c] = src[c];
+#ifdef BW_BRIDGE_NEON
+	for (; c + 8 <= num; c += 8)
+		vst1q_u16((uint16_t *)&dst[c], vld1q_u16(&src[c]));
+#else
+	for (; c + 2 <= num; c += 2) {
+		memcpy(&pair, &src[c], sizeof(pair));
+		*(volatile uint32_t *)&dst[c] = pair;
+	}
+#endif
+	for (; c < num; c++)
+		dst[c] = src[c];
 }
 
-void get_fpga_mem(struct bridge *br, uint16_t reg_addr, void* destination,
-		     size_t reg_num) {
-	unsigned int c;
+/*
+ * The block transfers return -EINVAL and touch nothing when the words don't
+ * fit the window.
+ */
+int set_fpga_mem(struct bridge *br, uint32_t reg_addr, const void* source,
+		 size_t reg_num) {
+	uint64_t start;
+
+	if (!bridge_in_window(reg_addr, reg_num))
+		return -EINVAL;
+
+	start = bridge_now_ns();
+	bridge_write_words((volatile uint16_t *)(br->virt_addr + reg_addr),
+			   (const uint16_t *)source, reg_num);
+	if (reg_addr >= BW_MATRIX_ADR)
+		br->wr_crc = bridge_crc16(br->wr_crc, source, reg_num);
+
+	br->wr_stats.ns += bridge_now_ns() - start;
+	br->wr_stats.calls++;
+	br->wr_stats.words += reg_num;
+	br->wr_stats.bytes += reg_num * 2;
+
+	return 0;
+}
+
+/*
+ * Write through the stream port: the start address is set once and the words
+ * go to the stream window, restarting at its base every BW_STREAM_WORDS so a
+ * burst never runs past it. The simulated window has nothing behind the
+ * stream port, so there it is a plain set_fpga_mem().
+ */
+int set_fpga_mem_stream(struct bridge *br, uint32_t reg_addr,
+			const void* source, size_t reg_num) {
+	const uint16_t *usrc = (const uint16_t *)source;
+	uint64_t start;
+	size_t c, n;
+
+	if (br->sim)
+		return set_fpga_mem(br, reg_addr, source, reg_num);
+	if (!bridge_in_window(reg_addr, reg_num))
+		return -EINVAL;
+
+	start = bridge_now_ns();
+	set_word(br, BW_REG_ADR(BW_REG_STREAM_ADDR), reg_addr / 2);
+	for (c = 0; c < reg_num; c += n) {
+		n = reg_num - c;
+		if (n > BW_STREAM_WORDS)
+			n = BW_STREAM_WORDS;
+		bridge_write_words((volatile uint16_t *)(br->virt_addr +
+							 BW_STREAM_ADR),
+				   &usrc[c], n);
+	}
+	if (reg_addr >= BW_MATRIX_ADR)
+		br->wr_crc = bridge_crc16(br->wr_crc, usrc, reg_num);
+
+	br->wr_stats.ns += bridge_now_ns() - start;
+	br->wr_stats.calls++;
+	br->wr_stats.words += reg_num + 1;
+	br->wr_stats.bytes += (reg_num + 1) * 2;
+
+	return 0;
+}
+
+int get_fpga_mem(struct bridge *br, uint32_t reg_addr, void* destination,
+		 size_t reg_num) {
+	size_t c;
 	uint16_t *udst = (uint16_t *)destination;
+	uint64_t start;
+
+	if (!bridge_in_window(reg_addr, reg_num))
+		return -EINVAL;
+
+	start = bridge_now_ns();
 	for (c = 0; c < reg_num; c++)
 		udst[c] = *(uint16_t *)(br->virt_addr + reg_addr + c*2);
+
+	br->rd_stats.ns += bridge_now_ns() - start;
+	br->rd_stats.calls++;
+	br->rd_stats.words += reg_num;
+	br->rd_stats.bytes += reg_num * 2;
+
+	return 0;
+}
+
+int bridge_shadow_init(struct bridge_shadow *sh, uint32_t reg_addr,
+		       size_t reg_num) {
+	if (!bridge_in_window(reg_addr, reg_num))
+		return -EINVAL;
+
+	sh->reg_addr = reg_addr;
+	sh->reg_num = reg_num;
+	sh->valid = 0;
+	sh->words = malloc(reg_num * sizeof(uint16_t));
+	if (!sh->words)
+		return -ENOMEM;
+
+	return 0;
+}
+
+/* Forget the shadow so the next delta upload rewrites the whole window */
+void bridge_shadow_invalidate(struct bridge_shadow *sh) {
+	sh->valid = 0;
+}
+
+void bridge_shadow_free(struct bridge_shadow *sh) {
+	free(sh->words);
+	sh->words = NULL;
+}
+
+/*
+ * Write only the spans of source that differ from the shadow, merging
+ * neighbouring dirty spans into one transfer. Returns the words written.
+ */
+size_t set_fpga_mem_delta(struct bridge *br, struct bridge_shadow *sh,
+			  const void* source) {
+	const uint16_t *usrc = (const uint16_t *)source;
+	size_t written = 0;
+	size_t run = 0;
+	size_t c, len;
+
+	if (!sh->valid) {
+		set_fpga_mem(br, sh->reg_addr, usrc, sh->reg_num);
+		memcpy(sh->words, usrc, sh->reg_num * sizeof(uint16_t));
+		sh->valid = 1;
+		return sh->reg_num;
+	}
+
+	for (c = 0; c < sh->reg_num; c += BW_SHADOW_SPAN) {
+		len = sh->reg_num - c < BW_SHADOW_SPAN ?
+			sh->reg_num - c : BW_SHADOW_SPAN;
+		if (!memcmp(&sh->words[c], &usrc[c], len * sizeof(uint16_t))) {
+			if (run) {
+				set_fpga_mem(br, sh->reg_addr + (c - run) * 2,
+					     &usrc[c - run], run);
+				written += run;
+				run = 0;
+			}
+			continue;
+		}
+		memcpy(&sh->words[c], &usrc[c], len * sizeof(uint16_t));
+		run += len;
+	}
+	if (run) {
+		set_fpga_mem(br, sh->reg_addr + (sh->reg_num - run) * 2,
+			     &usrc[sh->reg_num - run], run);
+		written += run;
+	}
+
+	return written;
+}
+
+/* Poll a register until (reg & mask) == value, 0 on success */
+static int bridge_poll(struct bridge *br, uint16_t reg, uint16_t mask,
+		       uint16_t value, unsigned int timeout_us) {
+	const struct timespec poll = {0, 50000};
+	uint64_t end = bridge_now_ns() + timeout_us * 1000ull;
+
+	while ((get_word(br, BW_REG_ADR(reg)) & mask) != value) {
+		if (bridge_now_ns() > end)
+			return -ETIMEDOUT;
+		nanosleep(&poll, NULL);
+	}
+
+	return 0;
+}
+
+/*
+ * Whether the bitstream was built with DOUBLE_BUFFER. Without it a swap only
+ * waits for the frame end and every upload still races the scan. The
+ * simulated window swaps its bank bit, so it counts as double buffered.
+ */
+int bridge_double_buffered(struct bridge *br) {
+	if (br->sim)
+		return 1;
+
+	return !!(get_word(br, BW_REG_ADR(BW_REG_STATUS)) & BW_STATUS_DOUBLE);
+}
+
+/*
+ * Whether the bitstream was built with PALETTE. Without it CTRL bit 1 is
+ * ignored and index frames are taken as plain pixels. The simulated window
+ * only stores the words, so it counts as having the palette.
+ */
+int bridge_has_palette(struct bridge *br) {
+	if (br->sim)
+		return 1;
+
+	return !!(get_word(br, BW_REG_ADR(BW_REG_STATUS)) & BW_STATUS_PALETTE);
+}
+
+/* Frame buffer bank the host should write, the one not being displayed */
+int bridge_back_bank(struct bridge *br) {
+	return !(get_word(br, BW_REG_ADR(BW_REG_STATUS)) & BW_STATUS_BANK);
+}
+
+/*
+ * Ask the FPGA to show the back bank from the next frame on. With a timeout
+ * this waits for the swap, after which the old front bank may be written.
+ */
+int bridge_swap_buffers(struct bridge *br, unsigned int timeout_us) {
+	uint16_t status;
+
+	br->wr_crc = BW_CRC_INIT;
+	if (br->sim) {
+		/* nothing scans the simulated window, swap straight away */
+		status = get_word(br, BW_REG_ADR(BW_REG_STATUS));
+		set_word(br, BW_REG_ADR(BW_REG_STATUS),
+			 (status ^ BW_STATUS_BANK) & ~BW_STATUS_SWAP);
+		return 0;
+	}
+
+	set_word(br, BW_REG_ADR(BW_REG_CMD), BW_CMD_SWAP);
+	if (!timeout_us)
+		return 0;
+
+	return bridge_poll(br, BW_REG_STATUS, BW_STATUS_SWAP, 0, timeout_us);
+}
+
+uint16_t bridge_frame_count(struct bridge *br) {
+	return get_word(br, BW_REG_ADR(BW_REG_FRAME_CNT));
+}
+
+/*
+ * Load num RGB565 palette entries from entry first on. The FPGA looks the
+ * colours up as it scans, so the change shows from the next row drawn.
+ */
+void bridge_set_palette(struct bridge *br, unsigned int first,
+			const uint16_t *rgb565, size_t num) {
+	if (first >= BW_PALETTE_SIZE)
+		return;
+	if (num > BW_PALETTE_SIZE - first)
+		num = BW_PALETTE_SIZE - first;
+	set_fpga_mem(br, BW_PALETTE_ADR + first * 2, rgb565, num);
+}
+
+/*
+ * Scroll the picture x columns left and y rows up, wrapping round the frame
+ * buffer. The FPGA holds X until Y is written and takes both at the end of
+ * the frame being drawn, so Y has to go last.
+ */
+void bridge_set_scroll(struct bridge *br, unsigned int x, unsigned int y) {
+	set_word(br, BW_REG_ADR(BW_REG_SCROLL_X), x);
+	set_word(br, BW_REG_ADR(BW_REG_SCROLL_Y), y);
+}
+
+/*
+ * Read the panel geometry the bitstream was built for. Bitstreams without
+ * the register, and the simulated bridge, read back 0 and get -ENODEV.
+ */
+int bridge_geometry(struct bridge *br, struct bridge_geometry *geo) {
+	uint16_t reg = get_word(br, BW_REG_ADR(BW_REG_GEOMETRY));
+
+	if (!reg || !BW_GEOMETRY_CHAIN(reg))
+		return -ENODEV;
+
+	geo->panel_width = BW_GEOMETRY_WIDTH(reg);
+	geo->panel_height = BW_GEOMETRY_HEIGHT(reg);
+	geo->chain = BW_GEOMETRY_CHAIN(reg);
+	geo->bcm_bits = BW_GEOMETRY_BCM(reg);
+	geo->width = geo->panel_width * geo->chain;
+	geo->height = geo->panel_height;
+
+	return 0;
+}
+
+/*
+ * Set the BCM unit delay and blanking pad in matrix clocks. The FPGA picks
+ * them up at the end of the frame being drawn.
+ */
+void bridge_set_timing(struct bridge *br, uint8_t bcm_unit,
+		       uint8_t blank_pad) {
+	set_word(br, BW_REG_ADR(BW_REG_BCM_UNIT), bcm_unit);
+	set_word(br, BW_REG_ADR(BW_REG_BLANK_PAD), blank_pad);
+}
+
+/*
+ * The simulated panel refreshes on multiples of BW_BRIDGE_SIM_FRAME_NS of
+ * the monotonic clock. Sleep to the next one and count it in the window.
+ */
+static void bridge_sim_frame(struct bridge *br) {
+	uint64_t next = (bridge_now_ns() / BW_BRIDGE_SIM_FRAME_NS + 1) *
+			BW_BRIDGE_SIM_FRAME_NS;
+	struct timespec ts = {next / 1000000000ull, next % 1000000000ull};
+	uint16_t status;
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+	set_word(br, BW_REG_ADR(BW_REG_FRAME_CNT), bridge_frame_count(br) + 1);
+	set_word(br, BW_REG_ADR(BW_REG_SCAN), 0);
+	status = get_word(br, BW_REG_ADR(BW_REG_STATUS));
+	set_word(br, BW_REG_ADR(BW_REG_STATUS), status | BW_STATUS_FRAME);
+}
+
+/*
+ * Wait for the panel to finish drawing a frame, so an upload that starts now
+ * has a whole frame time before row 0 is read again. Boundaries that passed
+ * before the call are ignored. 0 on success, -ETIMEDOUT otherwise.
+ */
+int bridge_wait_frame(struct bridge *br, unsigned int timeout_us) {
+	set_word(br, BW_REG_ADR(BW_REG_CMD), BW_CMD_FRAME_ACK);
+	if (br->sim) {
+		set_word(br, BW_REG_ADR(BW_REG_CMD), 0);
+		bridge_sim_frame(br);
+		return 0;
+	}
+
+	return bridge_poll(br, BW_REG_STATUS, BW_STATUS_FRAME, BW_STATUS_FRAME,
+			   timeout_us);
+}
+
+/* Restart the frame CRC on both sides, the next words written are checked */
+void bridge_crc_reset(struct bridge *br) {
+	set_word(br, BW_REG_ADR(BW_REG_CMD), BW_CMD_CRC_CLEAR);
+	if (br->sim)
+		set_word(br, BW_REG_ADR(BW_REG_CMD), 0);
+	br->wr_crc = BW_CRC_INIT;
+}
+
+/*
+ * Check that the FPGA took in every frame word written since the last
+ * bridge_crc_reset() or swap, with one register read instead of reading the
+ * frame back. Nothing computes the CRC behind the simulated window, so there
+ * it always passes. 0 on a match, -EIO otherwise.
+ */
+int bridge_verify_crc(struct bridge *br) {
+	if (br->sim)
+		return 0;
+
+	return get_word(br, BW_REG_ADR(BW_REG_FRAME_CRC)) == br->wr_crc ?
+		0 : -EIO;
+}
+
+/*
+ * Read a BW_PERF_* counter. The FPGA has no snapshot, so the high word is
+ * read again after the low one and the read retried if a carry got between.
+ */
+uint32_t bridge_perf_counter(struct bridge *br, unsigned int n) {
+	uint16_t reg = BW_REG_ADR(BW_REG_PERF + 2 * n);
+	uint16_t hi, lo;
+
+	do {
+		hi = get_word(br, reg + 2);
+		lo = get_word(br, reg);
+	} while (get_word(br, reg + 2) != hi);
+
+	return (uint32_t)hi << 16 | lo;
+}
+
+void bridge_perf_clear(struct bridge *br) {
+	set_word(br, BW_REG_ADR(BW_REG_CMD), BW_CMD_PERF_CLEAR);
+	if (br->sim)
+		set_word(br, BW_REG_ADR(BW_REG_CMD), 0);
+}
+
+/*
+ * Beam racing upload for a single buffered panel. The window holds two
+ * halves of row_words rows that are scanned out in pairs, row n of the
+ * first half with row n of the second. Rows are written starting just
+ * behind the pair being drawn, which BW_REG_SCAN gives with the scroll
+ * already applied, and wrapping round to it, so the scan only
+ * ever reaches rows of the new frame, and a whole frame goes in well within
+ * one row time. Rows equal to the shadow are skipped. Returns the words
+ * written.
+ */
+size_t set_fpga_mem_scan(struct bridge *br, struct bridge_shadow *sh,
+			 const void* source, size_t row_words) {
+	const uint16_t *usrc = (const uint16_t *)source;
+	size_t pairs = sh->reg_num / row_words / 2;
+	size_t half = pairs * row_words;
+	size_t written = 0;
+	size_t i, row, off;
+	int h;
+
+	row = BW_SCAN_ROW(get_word(br, BW_REG_ADR(BW_REG_SCAN)));
+	for (i = 1; i <= pairs; i++) {
+		for (h = 0; h < 2; h++) {
+			off = h * half + ((row + i) % pairs) * row_words;
+			if (sh->valid && !memcmp(&sh->words[off], &usrc[off],
+						 row_words * sizeof(uint16_t)))
+				continue;
+			set_fpga_mem(br, sh->reg_addr + off * 2, &usrc[off],
+				     row_words);
+			memcpy(&sh->words[off], &usrc[off],
+			       row_words * sizeof(uint16_t));
+			written += row_words;
+		}
+	}
+	sh->valid = 1;
+
+	return written;
+}
+
+void bridge_reset_stats(struct bridge *br) {
+	memset(&br->wr_stats, 0, sizeof(br->wr_stats));
+	memset(&br->rd_stats, 0, sizeof(br->rd_stats));
+}
+
+static void bridge_print_stat(FILE *f, const char *name,
+			      const struct bridge_stats *st) {
+	double us = st->ns / 1000.0;
+
+	fprintf(f, "%s: %llu calls, %llu words, %llu bytes, %.1f us",
+		name, (unsigned long long)st->calls,
+		(unsigned long long)st->words,
+		(unsigned long long)st->bytes, us);
+	if (st->calls)
+		fprintf(f, " (%.2f us/call", us / st->calls);
+	if (st->calls && st->ns)
+		fprintf(f, ", %.1f MB/s", st->bytes * 1000.0 / st->ns);
+	fprintf(f, "%s\n", st->calls ? ")" : "");
+}
+
+void bridge_print_stats(struct bridge *br, FILE *f) {
+	fprintf(f, "bridge (%s)\n", br->sim ? "simulated" : "/dev/mem");
+	bridge_print_stat(f, "  write", &br->wr_stats);
+	bridge_print_stat(f, "  read ", &br->rd_stats);
 }
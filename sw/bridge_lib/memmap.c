@@ -1,17 +1,72 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime, nanosleep
 #include <stdio.h>
 #include <getopt.h>
 #include <stdlib.h>
+#include <time.h>
 #include "bw_bridge.h"
 #define word_access
 
 void print_usage()
 {
 	printf("USAGE:\tmemmap -a ADDR [-w VAL]\n");
+	printf("\tmemmap -p [-c]\n");
 	printf("\t-a, --address   ADDR\t16 bit word address (hex)\n");
 	printf("\t-w, --write     VAL\tValue to write (hex)\n");
+	printf("\t-p, --perf\t\tDump the FPGA performance counters and their rates over 1 s\n");
+	printf("\t-c, --clear\t\tClear them after the dump\n");
 	printf("\nEXAMPLE: memmap -a 0 -w DEAD\n");
 }
 
+static const char *perf_names[BW_PERF_COUNTERS] = {
+	[BW_PERF_FRAMES]	= "frames",
+	[BW_PERF_MEM_WR]	= "frame buffer writes",
+	[BW_PERF_REG_WR]	= "register writes",
+	[BW_PERF_TEAR]		= "tear writes",
+	[BW_PERF_CLOCKS]	= "clocks",
+};
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void read_perf(struct bridge *br, uint32_t *count)
+{
+	int n;
+
+	for (n = 0; n < BW_PERF_COUNTERS; n++)
+		count[n] = bridge_perf_counter(br, n);
+}
+
+/*
+ * The counters wrap, PERF_CLOCKS after about 43 s, so the rates come from
+ * two reads a second apart, the clock rate included. The simulated bridge's
+ * counters don't move and get no rates.
+ */
+void print_perf(struct bridge *br)
+{
+	const struct timespec wait = { 1, 0 };
+	uint32_t c0[BW_PERF_COUNTERS], c1[BW_PERF_COUNTERS];
+	double t0, dt;
+	int n;
+
+	t0 = now_s();
+	read_perf(br, c0);
+	nanosleep(&wait, NULL);
+	dt = now_s() - t0;
+	read_perf(br, c1);
+
+	for (n = 0; n < BW_PERF_COUNTERS; n++) {
+		printf("%-20s %10u", perf_names[n], c1[n]);
+		if (c1[BW_PERF_CLOCKS] != c0[BW_PERF_CLOCKS])
+			printf("  %.1f/s", (uint32_t)(c1[n] - c0[n]) / dt);
+		printf("\n");
+	}
+}
+
 int main(int argc, char *argv[])
 {
 	struct bridge br;
@@ -22,15 +77,19 @@ int main(int argc, char *argv[])
 	int address = 0;
 	int value = 0;
 	int is_write = 0;
+	int is_perf = 0;
+	int is_clear = 0;
 
 	static struct option long_opts[]=
 	{
 		{ "address", required_argument, 0, 'a' },
 		{ "write", required_argument, 0, 'w' },
+		{ "perf", no_argument, 0, 'p' },
+		{ "clear", no_argument, 0, 'c' },
 		{ 0, 0, 0, 0 },
 	};
 
-	while((c = getopt_long(argc, argv, "a:w:",
+	while((c = getopt_long(argc, argv, "a:w:pc",
 			       long_opts, &opt_i)) != -1)
 	{
 		switch(c)
@@ -43,6 +102,12 @@ int main(int argc, char *argv[])
 			value = strtoul(optarg, NULL, 16);
 			is_write = 1;
 			break;
+		case 'p':
+			is_perf = 1;
+			break;
+		case 'c':
+			is_clear = 1;
+			break;
 		case '?':
 			print_usage();
 			return 0;
@@ -55,6 +120,16 @@ int main(int argc, char *argv[])
 
 	void *ptr = br.virt_addr;
 
+	if (is_perf || is_clear)
+	{
+		if (is_perf)
+			print_perf(&br);
+		if (is_clear)
+			bridge_perf_clear(&br);
+		bridge_close(&br);
+		return 0;
+	}
+
 	if (is_write)
 	{
 		*(uint16_t *)(ptr + address) = value;
@@ -0,0 +1,49 @@
+#ifndef _BW_ASYNC_H_
+#define _BW_ASYNC_H_
+
+#include <pthread.h>
+#include "bw_bridge.h"
+
+/*
+ * Asynchronous uploads. Transfers are queued to a worker that runs the copy
+ * in order, calls done() from the worker thread if it is set, then counts
+ * the completion on an eventfd that can be polled along with any other
+ * descriptors. /dev/mem gives userspace no way to drive the AM335x EDMA, so
+ * the worker does a CPU copy on target as well as on the simulated bridge;
+ * a dmaengine backed driver would replace the worker behind the same calls.
+ * Until then this is not an offload: the single core AM335x spends the same
+ * CPU time on the copy, only on another thread, so it decouples the caller
+ * from the upload's latency but saves nothing.
+ *
+ * While transfers are queued the worker owns the bridge's frame memory
+ * writes and write statistics, register accesses are still safe.
+ */
+struct bridge_xfer {
+	uint32_t		reg_addr;
+	const void		*source;
+	size_t			reg_num;
+	struct bridge_shadow	*sh;	/* delta upload against sh, or NULL */
+	void			(*done)(struct bridge_xfer *xfer);
+	void			*priv;
+	size_t			written;	/* words, set before done() */
+	struct bridge_xfer	*next;
+};
+
+struct bridge_async {
+	struct bridge		*br;
+	pthread_t		thread;
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	struct bridge_xfer	*head;
+	struct bridge_xfer	*tail;
+	int			event_fd;
+	int			stop;
+};
+
+int bridge_async_init(struct bridge_async *as, struct bridge *br);
+void bridge_async_close(struct bridge_async *as);
+void bridge_async_submit(struct bridge_async *as, struct bridge_xfer *xfer);
+int bridge_async_fd(struct bridge_async *as);
+int bridge_async_wait(struct bridge_async *as, int timeout_ms);
+
+#endif
@@ -12,20 +12,171 @@
 #define BW_BRIDGE_MEM_ADR 0x01000000
 #define BW_BRIDGE_MEM_SIZE 0x20000
 
+/*
+ * Simulated bridge: when built with -DBW_BRIDGE_SIM or run with the
+ * BW_BRIDGE_SIM environment variable set, the GPMC window is replaced by a
+ * shared file mapping of the same size. The variable may name the backing
+ * file, otherwise BW_BRIDGE_SIM_FILE is used.
+ */
+#define BW_BRIDGE_SIM_ENV "BW_BRIDGE_SIM"
+#define BW_BRIDGE_SIM_FILE "/dev/shm/bw_bridge_sim"
+/* refresh period of the simulated panel, about what the FPGA draws at */
+#define BW_BRIDGE_SIM_FRAME_NS	5184000
+
+/* Opallios register file, 16 bit word offsets from the start of the window */
+#define BW_REG_SCRATCH		0x0
+#define BW_REG_CTRL		0x1
+#define BW_REG_CMD		0x2	/* write 1 to issue, reads back pending */
+#define BW_REG_STATUS		0x3	/* read only */
+#define BW_REG_FRAME_CNT	0x4	/* read only, frames drawn, wraps */
+#define BW_REG_SCAN		0x5	/* read only, buffer row pair and plane */
+#define BW_REG_BCM_UNIT		0x6	/* matrix clocks in the LSB plane, 7:0 */
+#define BW_REG_BLANK_PAD	0x7	/* extra blanking clocks per plane, 7:0 */
+/* 0x8 and 0x9 are reserved */
+#define BW_REG_GEOMETRY		0xa	/* read only, see BW_GEOMETRY_* */
+#define BW_REG_STREAM_ADDR	0xb	/* word address of the next stream write */
+#define BW_REG_SCROLL_X		0xc	/* columns scrolled left, taken with Y */
+#define BW_REG_SCROLL_Y		0xd	/* rows scrolled up, from next frame */
+#define BW_REG_FRAME_CRC	0xe	/* read only, CRC of the frame words written */
+#define BW_REG_PERF		0x10	/* read only, BW_PERF_* counters, 2 words each */
+#define BW_REG_ADR(reg)		((reg) * 2)
+
+/*
+ * Stream window, byte offset and size in words. Every write to it lands at
+ * BW_REG_STREAM_ADDR, which then counts up, so the address bus is ignored.
+ */
+#define BW_STREAM_ADR		0x2000
+#define BW_STREAM_WORDS		0x1000
+
+/* Frame window byte offset, the words written from here on are in the CRC */
+#define BW_MATRIX_ADR		0x4000
+
+/*
+ * CRC-16/CCITT-FALSE (poly 0x1021, MSB first) over every word written to the
+ * frame window, in write order, since reset, BW_CMD_SWAP or BW_CMD_CRC_CLEAR.
+ */
+#define BW_CRC_INIT		0xffff
+
+#define BW_CTRL_RGB565		(1 << 0)	/* one RGB565 word per pixel */
+#define BW_CTRL_PALETTE		(1 << 1)	/* two 8 bit palette indices per word */
+
+/* RGB565 palette for BW_CTRL_PALETTE, byte offset and entries */
+#define BW_PALETTE_ADR		0x200
+#define BW_PALETTE_SIZE		256
+
+#define BW_CMD_SWAP		(1 << 0)	/* swap banks at frame end */
+#define BW_CMD_FRAME_ACK	(1 << 1)	/* clear BW_STATUS_FRAME */
+#define BW_CMD_CRC_CLEAR	(1 << 2)	/* restart BW_REG_FRAME_CRC */
+#define BW_CMD_PERF_CLEAR	(1 << 3)	/* zero the BW_PERF_* counters */
+
+#define BW_STATUS_BANK		(1 << 0)	/* bank being displayed */
+#define BW_STATUS_SWAP		(1 << 1)	/* swap still pending */
+#define BW_STATUS_FRAME		(1 << 2)	/* sticky, frame ended since ack */
+#define BW_STATUS_DOUBLE	(1 << 3)	/* bitstream has a back bank */
+#define BW_STATUS_WR_OVF	(1 << 4)	/* sticky, GPMC burst words lost */
+#define BW_STATUS_PALETTE	(1 << 5)	/* bitstream has the palette */
+
+/*
+ * Free running 32 bit counters from reset or BW_CMD_PERF_CLEAR, low word at
+ * BW_REG_PERF + 2 * n. They wrap, so rates come from the difference of two
+ * reads, PERF_CLOCKS wraps about every 43 s at 100 MHz.
+ */
+#define BW_PERF_FRAMES		0	/* frames scanned out */
+#define BW_PERF_MEM_WR		1	/* words taken into the frame buffer */
+#define BW_PERF_REG_WR		2	/* register writes */
+#define BW_PERF_TEAR		3	/* pixels written to the row being read out */
+#define BW_PERF_CLOCKS		4	/* FPGA bus side clock cycles */
+#define BW_PERF_COUNTERS	5
+
+#define BW_SCAN_ROW(scan)	((scan) & 0x1f)
+#define BW_SCAN_PLANE(scan)	(((scan) >> 8) & 0x7)
+
+#define BW_GEOMETRY_WIDTH(geo)	(1 << ((geo) & 0xf))		/* per panel */
+#define BW_GEOMETRY_HEIGHT(geo)	(1 << (((geo) >> 4) & 0xf))
+#define BW_GEOMETRY_CHAIN(geo)	(((geo) >> 8) & 0xf)		/* panels chained */
+#define BW_GEOMETRY_BCM(geo)	(((geo) >> 12) & 0xf)		/* bit planes */
+
+/*
+ * Pixels the FPGA displays. Chained panels form one display chain times as
+ * wide as a panel, stored row major like a single panel. The frame window
+ * holds 2 words per pixel, or 1 in RGB565.
+ */
+struct bridge_geometry {
+	unsigned int	panel_width;
+	unsigned int	panel_height;
+	unsigned int	chain;
+	unsigned int	bcm_bits;
+	unsigned int	width;
+	unsigned int	height;
+};
+
+struct bridge_stats {
+	uint64_t	calls;
+	uint64_t	words;
+	uint64_t	bytes;
+	uint64_t	ns;
+};
+
+/*
+ * Delta uploads keep a shadow of what the FPGA holds for one window and only
+ * write the BW_SHADOW_SPAN word spans that changed. Spans stay pixel aligned
+ * so the RG/B word pairs of the matrix memory are always written together.
+ */
+#define BW_SHADOW_SPAN 64
+
+struct bridge_shadow {
+	uint32_t	reg_addr;
+	size_t		reg_num;
+	uint16_t	*words;
+	int		valid;
+};
+
 struct bridge {
 	void		*virt_addr;
 	int		mem_dev;
 	uint32_t	alloc_mem_size;
 	void		*mem_pointer;
+	int		sim;
+	uint16_t	wr_crc;		/* host side of BW_REG_FRAME_CRC */
+	struct bridge_stats	wr_stats;
+	struct bridge_stats	rd_stats;
 };
 
 int bridge_init();
 void bridge_close();
-uint16_t get_word(struct bridge *br, uint16_t reg_addr);
-void set_word(struct bridge *br, uint16_t reg_addr, uint16_t word);
-void set_fpga_mem(struct bridge *br, uint16_t reg_addr, const void* source,
-		     size_t reg_num);
-void get_fpga_mem(struct bridge *br, uint16_t reg_addr, void* destination,
-		  size_t reg_num);
+uint16_t get_word(struct bridge *br, uint32_t reg_addr);
+void set_word(struct bridge *br, uint32_t reg_addr, uint16_t word);
+int set_fpga_mem(struct bridge *br, uint32_t reg_addr, const void* source,
+		 size_t reg_num);
+int set_fpga_mem_stream(struct bridge *br, uint32_t reg_addr,
+			const void* source, size_t reg_num);
+int get_fpga_mem(struct bridge *br, uint32_t reg_addr, void* destination,
+		 size_t reg_num);
+size_t set_fpga_mem_delta(struct bridge *br, struct bridge_shadow *sh,
+			  const void* source);
+size_t set_fpga_mem_scan(struct bridge *br, struct bridge_shadow *sh,
+			 const void* source, size_t row_words);
+int bridge_shadow_init(struct bridge_shadow *sh, uint32_t reg_addr,
+		       size_t reg_num);
+void bridge_shadow_invalidate(struct bridge_shadow *sh);
+void bridge_shadow_free(struct bridge_shadow *sh);
+int bridge_double_buffered(struct bridge *br);
+int bridge_has_palette(struct bridge *br);
+int bridge_back_bank(struct bridge *br);
+int bridge_swap_buffers(struct bridge *br, unsigned int timeout_us);
+uint16_t bridge_frame_count(struct bridge *br);
+void bridge_set_palette(struct bridge *br, unsigned int first,
+			const uint16_t *rgb565, size_t num);
+void bridge_set_scroll(struct bridge *br, unsigned int x, unsigned int y);
+int bridge_geometry(struct bridge *br, struct bridge_geometry *geo);
+void bridge_set_timing(struct bridge *br, uint8_t bcm_unit,
+		       uint8_t blank_pad);
+int bridge_wait_frame(struct bridge *br, unsigned int timeout_us);
+void bridge_crc_reset(struct bridge *br);
+int bridge_verify_crc(struct bridge *br);
+uint32_t bridge_perf_counter(struct bridge *br, unsigned int n);
+void bridge_perf_clear(struct bridge *br);
+void bridge_reset_stats(struct bridge *br);
+void bridge_print_stats(struct bridge *br, FILE *f);
 
 #endif
@@ -0,0 +1,64 @@
+#define _POSIX_C_SOURCE 200112L // needed for sem_t
+#include <errno.h>
+#include <stdlib.h>
+#include "framering.h"
+
+// The counters wrap at twice the slot count, so a full ring (head - tail == FRAMERING_SLOTS)
+// is still told apart from an empty one, and the slot index never jumps as it would when a
+// free running counter wraps at a value that isn't a multiple of FRAMERING_SLOTS
+static unsigned frameRingNext(unsigned i) {
+    return (i + 1) % (2 * FRAMERING_SLOTS);
+}
+
+int frameRingInit(frameRing* ring, size_t words) {
+    for (int i = 0; i < FRAMERING_SLOTS; i++) {
+        ring->buffers[i] = malloc(words * sizeof(uint16_t));
+        ring->data[i] = NULL;
+        if (ring->buffers[i] == NULL) return -ENOMEM;
+    }
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return sem_init(&ring->freeSlots, 0, FRAMERING_SLOTS);
+}
+
+void frameRingFree(frameRing* ring) {
+    sem_destroy(&ring->freeSlots);
+    for (int i = 0; i < FRAMERING_SLOTS; i++) {
+        free(ring->buffers[i]);
+    }
+}
+
+// Render side: wait for a free slot and return its buffer
+uint16_t* frameRingAcquire(frameRing* ring) {
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    while (sem_wait(&ring->freeSlots) == -1 && errno == EINTR) {
+    }
+    return ring->buffers[head % FRAMERING_SLOTS];
+}
+
+// Render side: hand the acquired slot to the upload thread, data is the slot's
+// buffer or any other frame that stays valid until it has been uploaded
+void frameRingPublish(frameRing* ring, const uint16_t* data) {
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    ring->data[head % FRAMERING_SLOTS] = data;
+    atomic_store_explicit(&ring->head, frameRingNext(head), memory_order_release);
+}
+
+// Upload side: oldest published frame, NULL if the render thread is behind
+const uint16_t* frameRingPeek(frameRing* ring) {
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    if (tail == atomic_load_explicit(&ring->head, memory_order_acquire)) return NULL;
+    return ring->data[tail % FRAMERING_SLOTS];
+}
+
+// Upload side: the frame from frameRingPeek has been sent, reuse its slot. Called
+// from the async worker with -a, never at the same time as frameRingPeek
+void frameRingRelease(frameRing* ring) {
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    atomic_store_explicit(&ring->tail, frameRingNext(tail), memory_order_release);
+    sem_post(&ring->freeSlots);
+}
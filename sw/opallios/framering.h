@@ -0,0 +1,35 @@
+// Single producer, single consumer ring of packed frames
+
+#ifndef _FRAMERING_H_
+#define _FRAMERING_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <semaphore.h>
+
+#define FRAMERING_SLOTS 3
+
+// The render thread fills a slot's buffer, or points the slot at a frame that
+// is already packed, and publishes it. The upload thread takes the oldest slot
+// and releases it once the upload is done. With async uploads (-a) the release
+// comes from the async engine's worker when the write completes, and the
+// upload thread only peeks again after it has seen that completion, so there
+// is still a single consumer at any time. The indices are lock free, the
+// semaphore only parks the render thread while every slot is in use.
+typedef struct frameRing {
+    uint16_t* buffers[FRAMERING_SLOTS];
+    const uint16_t* data[FRAMERING_SLOTS];
+    atomic_uint head; // next slot to publish, render thread only, counts modulo 2 * FRAMERING_SLOTS
+    atomic_uint tail; // next slot to upload, consumer only (upload thread, or async worker on release), same
+    sem_t freeSlots;
+} frameRing;
+
+int frameRingInit(frameRing* ring, size_t words);
+void frameRingFree(frameRing* ring);
+uint16_t* frameRingAcquire(frameRing* ring);
+void frameRingPublish(frameRing* ring, const uint16_t* data);
+const uint16_t* frameRingPeek(frameRing* ring);
+void frameRingRelease(frameRing* ring);
+
+#endif
@@ -0,0 +1,99 @@
+#define _POSIX_C_SOURCE 200112L // needed for clock_gettime, clock_nanosleep
+#include <errno.h>
+#include <string.h>
+#include "frametime.h"
+
+uint64_t frameTimeUs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static void timespecAddNs(struct timespec* ts, int64_t ns) {
+    ns += ts->tv_nsec;
+    ts->tv_sec += ns / 1000000000;
+    ts->tv_nsec = ns % 1000000000;
+}
+
+static int64_t timespecDiffNs(const struct timespec* a, const struct timespec* b) {
+    return (int64_t)(a->tv_sec - b->tv_sec) * 1000000000 + (a->tv_nsec - b->tv_nsec);
+}
+
+// First deadline is one period from now
+void framePacerInit(framePacer* pacer, long periodNs) {
+    memset(pacer, 0, sizeof(*pacer));
+    pacer->periodNs = periodNs;
+    clock_gettime(CLOCK_MONOTONIC, &pacer->deadline);
+    timespecAddNs(&pacer->deadline, periodNs);
+}
+
+// Sleep until the current deadline and advance it by one period. Returns how
+// late the caller already was in ns, 0 when the deadline was met. After an
+// overrun longer than a period the missed deadlines are dropped, keeping the
+// phase, rather than running a burst of catch-up frames.
+int64_t framePacerWait(framePacer* pacer) {
+    struct timespec now;
+    int64_t late;
+
+    pacer->frames++;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    late = timespecDiffNs(&now, &pacer->deadline);
+    if (late > 0) {
+        pacer->overruns++;
+        timespecAddNs(&pacer->deadline, (late / pacer->periodNs + 1) * pacer->periodNs);
+        return late;
+    }
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &pacer->deadline, NULL) == EINTR) {
+    }
+    timespecAddNs(&pacer->deadline, pacer->periodNs);
+    return 0;
+}
+
+void frameHistReset(frameHist* hist) {
+    memset(hist, 0, sizeof(*hist));
+}
+
+void frameHistAdd(frameHist* hist, uint32_t us) {
+    if (us < FRAMEHIST_BINS) hist->bins[us]++;
+    else hist->overflow++;
+    if (us > hist->max) hist->max = us;
+    hist->sum += us;
+    hist->count++;
+}
+
+// Smallest time that at least pct percent of the samples do not exceed
+uint32_t frameHistPercentile(const frameHist* hist, double pct) {
+    uint64_t target = (uint64_t)(hist->count * pct / 100.0 + 0.5);
+    uint64_t seen = 0;
+
+    if (target == 0) target = 1;
+    for (uint32_t us = 0; us < FRAMEHIST_BINS; us++) {
+        seen += hist->bins[us];
+        if (seen >= target) return us;
+    }
+    return hist->max;
+}
+
+// Number of samples that took longer than us
+uint32_t frameHistOver(const frameHist* hist, uint32_t us) {
+    uint32_t over = hist->overflow;
+    for (uint32_t i = us + 1; i < FRAMEHIST_BINS; i++) {
+        over += hist->bins[i];
+    }
+    return over;
+}
+
+void frameHistPrint(const frameHist* hist, const char* name, FILE* f) {
+    if (hist->count == 0) {
+        fprintf(f, "%-8s no samples\n", name);
+        return;
+    }
+    fprintf(f, "%-8s mean %6llu  p50 %6u  p95 %6u  p99 %6u  max %6u us\n",
+            name,
+            (unsigned long long)(hist->sum / hist->count),
+            frameHistPercentile(hist, 50),
+            frameHistPercentile(hist, 95),
+            frameHistPercentile(hist, 99),
+            hist->max);
+}
@@ -0,0 +1,38 @@
+// Frame time statistics and pacing
+
+#ifndef _FRAMETIME_H_
+#define _FRAMETIME_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// 1 us bins, anything slower lands in the overflow count
+#define FRAMEHIST_BINS 50000
+
+typedef struct frameHist {
+    uint32_t bins[FRAMEHIST_BINS];
+    uint32_t overflow;
+    uint32_t count;
+    uint32_t max;
+    uint64_t sum;
+} frameHist;
+
+// Absolute deadline frame pacer on CLOCK_MONOTONIC, free of drift
+typedef struct framePacer {
+    struct timespec deadline;
+    long periodNs;
+    uint32_t frames;
+    uint32_t overruns;
+} framePacer;
+
+uint64_t frameTimeUs(void);
+void framePacerInit(framePacer* pacer, long periodNs);
+int64_t framePacerWait(framePacer* pacer);
+void frameHistReset(frameHist* hist);
+void frameHistAdd(frameHist* hist, uint32_t us);
+uint32_t frameHistPercentile(const frameHist* hist, double pct);
+uint32_t frameHistOver(const frameHist* hist, uint32_t us);
+void frameHistPrint(const frameHist* hist, const char* name, FILE* f);
+
+#endif
@@ -1,5 +1,4 @@
-#define _XOPEN_SOURCE 500 // needed for nanosleep
-#define __USE_POSIX199309 // needed for nanosleep
+#define _XOPEN_SOURCE 500 // needed for M_PI
 #include <stdio.h>
 #include <getopt.h>
 #include <stdlib.h>
@@ -8,29 +7,165 @@
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
 #include <time.h>
 #include <math.h>
 #include "bw_bridge.h"
+#include "bw_async.h"
 #include "badglib.h"
 #include "fast_obj.h"
+#include "frametime.h"
+#include "framering.h"
+#include "pixelpack.h"
 
-// Screen size
-#define SCREEN_WIDTH 64
-#define SCREEN_HEIGHT 64
-#define NUMPIXELS SCREEN_WIDTH * SCREEN_HEIGHT
+// Screen size, read from the FPGA unless given with -G, chained panels are one wide screen
+#define DEFAULT_WIDTH 64
+#define DEFAULT_HEIGHT 64
 #define FPGA_MEM_OFFSET 0x4000
+static int screenWidth = 0;
+static int screenHeight = 0;
+static int numPixels;
 
 // Frame timer
 #define FPS 100
 #define FRAMETIME_US ((int)(1.0/FPS * 1e9)) // 10 ms / 100Hz
 
-void *FrameTimerThread(void *vargp);
+#define FRAME_BUDGET_US (FRAMETIME_US / 1000) // FRAMETIME_US is really in ns
+#define FRAMETIME_REPORT (FPS * 10) // -t prints a summary every 10 s
+
+#define NUM_MODES 9
+
+void *UploadThread(void *vargp);
 
 //Format data for gpmc
 void loadMatrixData(uint16_t* matrixData, Image* fbuf, int FrameNum);
+static inline void packPixel(uint16_t* matrixData, int i, uint8_t r, uint8_t g, uint8_t b);
+
+// Per-mode rendering, split from packing so they can be timed separately
+void initScenes(void);
+void renderFrame(int mode);
+const uint16_t* packFrame(int mode, uint16_t* matrixData);
+void cacheImageFrames(void);
+void runBenchmark(struct bridge* br, int benchFrames);
+void uploadFrame(struct bridge* br, const uint16_t* matrixData);
+int vsyncWait(struct bridge* br, uint16_t* lastFrame);
+
+// Shadow of each FPGA frame buffer bank, only changed spans are uploaded unless fullUpload is set
+static struct bridge_shadow frameShadow[2];
+static bool fullUpload = false;
+// Send full uploads through the FPGA's auto incrementing stream port
+static bool streamUpload = false;
+// Write the back bank and swap after each upload, for double buffered bitstreams
+static bool swapBuffers = false;
+// Write rows in scan order just behind the row being drawn, tear free with a single buffer
+static bool raceBeam = false;
+#define SWAP_TIMEOUT_US (2 * FRAME_BUDGET_US)
+// Upload every vsyncFrames panel refreshes instead of on the CPU clock, 0 to disable
+static int vsyncFrames = 0;
+// Hand uploads to the bridge's async engine, the upload thread only paces and submits. The engine's
+// worker still does the CPU copy, so on the single core AM335x this moves the work, it doesn't save any
+static bool asyncUpload = false;
+static struct bridge_async uploadEngine;
+static struct bridge_xfer uploadXfer;
+
+// GPMC transfer format, loose is G<<8|R then B for every pixel, dense is one RGB565 word per pixel
+static bool densePack = false;
+// The fire effect's palette indices go up as is, two per word, and the FPGA looks up the colours
+static bool palettePack = false;
+static int frameWords;
+// Gamma correct and temporally dither every frame as it is packed
+static bool gammaCorrect = false;
+static pixelGamma frameGamma;
+static unsigned ditherFrame = 0;
+// Bit planes the FPGA shows per channel, the loose format is dithered down to them
+static int bcmBits = 6;
+// Check every upload against the FPGA's frame CRC, and count the ones that didn't arrive intact
+static bool verifyUpload = false;
+static unsigned int verifyFailed = 0;
+// Hardware scroll step per upload, the FPGA wraps the picture round so a static frame becomes a marquee
+static int scrollStepX = 0, scrollStepY = 0;
+static unsigned scrollX = 0, scrollY = 0;
+// BCM unit delay in matrix clocks, shorter is a faster panel refresh but dimmer, 0 keeps the FPGA's
+static int bcmUnit = 0;
+
+// Frames rendered ahead of the upload thread
+static frameRing frameQueue;
+
+// Image/gif
+static Image img;
+static int numFrames;
+static int currentFrame = 0;
+static int imgFrame = 0;
+static uint16_t* imgFrames; // every frame of img already packed for upload
+
+// SW rendering frame buffer and objects
+static Image fbuf;
+//lets represent a wireframe shape as some vectors
+static Vector2 vertices[] = {{-16.0, -8.0}, {16.0, -8.0}, {0.0, 8.0}};
+static int lineIndices[] = {0, 1, 1, 2, 2, 0};
+static shape2d triangle = {
+    .numVertices = 3,
+    .numLines = 3,
+    .vertices = vertices,
+    .lineIndices = lineIndices
+};
+
+static float angle = 0;
+
+// 3d shape
+// Triangular prism
+static shape3d triangularPrism = {
+    .numFaces = 5,
+    .vertices = (Vector3[]){{0, 16, 0}, {-16, -16, -16}, {16, -16, -16}, {16, -16, 16}, {-16, -16, 16}},
+    .faceVertices = (int[]){
+        0, 2, 1,   // Face 1
+        0, 3, 2,   // Face 2
+        0, 4, 3,   // Face 3
+        0, 1, 4,   // Face 4
+        4, 1, 2, 3 // Face 5 (square)
+    },
+    .numVerticesPerFace = (int[]){3, 3, 3, 3, 4}
+};
+
+static shape3d sphere;
+static shape3d heightMap;
+static shape3d obj;
+
+// Cube
+static shape3d cube = {
+    .numFaces = 6,
+    .vertices = (Vector3[]){
+        {-16,  16,  16}, // 0
+        { 16,  16,  16}, // 1
+        { 16, -16,  16}, // 2
+        {-16, -16,  16}, // 3
+        {-16,  16, -16}, // 4
+        { 16,  16, -16}, // 5
+        { 16, -16, -16}, // 6
+        {-16, -16, -16}  // 7
+    },
+    .faceVertices = (int[]){
+        0, 3, 2, 1, // Front face
+        4, 5, 6, 7, // Back face
+        0, 1, 5, 4, // Top face
+        2, 3, 7, 6, // Bottom face
+        0, 4, 7, 3, // Left face
+        1, 2, 6, 5  // Right face
+    },
+    .numVerticesPerFace = (int[]){4, 4, 4, 4, 4, 4}
+};
+
+static Vector3 rotationAngles = {0.0,0.0,0.0};
+static Vector3 rotatedAngle;
+
+// Fire effect palette
+static Color colors[256];
+static pixelPalette firePalette; // colors packed for upload
+static uint16_t fire565[256]; // colors for the FPGA palette
 
 // Fire effect
-static uint8_t fire[NUMPIXELS];
+static uint8_t* fire;
+static Color* fireRGBA; // gamma corrected fire goes through RGBA
 
 // Star field
 #define NUM_STARS 100
@@ -55,11 +190,10 @@ int main(int argc, char *argv[])
     int opt;
 
     char filename[256];
-    int numFrames;
-    Image img;
 
     int mode = 0; // choose what function is being displayed
     bool printFrameTimes = false;
+    int benchFrames = 0;
 
     // Handle input arguments
     static struct option long_opts[]= //parse arguments to read file name with -f
@@ -67,10 +201,24 @@ int main(int argc, char *argv[])
         { "filename"    , required_argument, 0, 'f' }, // Filename
         { "mode"        , optional_argument, 0, 'm' }, // mode 0 = gif/image, 1 = software rendering
         { "frametimes"  , no_argument      , 0, 't' },
+        { "bench"       , required_argument, 0, 'b' }, // run every mode for N frames and exit
+        { "full-upload" , no_argument      , 0, 'F' }, // rewrite the whole frame every time
+        { "swap"        , no_argument      , 0, 's' }, // swap FPGA frame buffers after each upload, DOUBLE_BUFFER bitstreams (32x32 on the HX4K) only
+        { "vsync"       , required_argument, 0, 'v' }, // upload every N panel refreshes
+        { "race"        , no_argument      , 0, 'r' }, // upload rows in scan order behind the beam
+        { "rgb565"      , no_argument      , 0, 'p' }, // dense one word per pixel transfer format
+        { "async"       , no_argument      , 0, 'a' }, // upload from the async engine's worker thread, same CPU copy, no offload
+        { "gamma"       , required_argument, 0, 'g' }, // gamma exponent with temporal dithering, 0 for CIE lightness
+        { "bcm-unit"    , required_argument, 0, 'u' }, // LSB plane period in matrix clocks, 1-255
+        { "geometry"    , required_argument, 0, 'G' }, // WxH screen size, overrides the FPGA's
+        { "stream"      , no_argument      , 0, 'S' }, // full uploads through the stream port
+        { "palette"     , no_argument      , 0, 'P' }, // indexed frames for the fire effect, needs a PALETTE bitstream
+        { "scroll"      , required_argument, 0, 'x' }, // DX:DY pixels the FPGA scrolls the picture per upload
+        { "verify"      , no_argument      , 0, 'V' }, // check each upload with the FPGA frame CRC, not with --async
         { 0, 0, 0, 0 },
     };
 
-    while((opt = getopt_long(argc, argv, "m:f:t", long_opts, &opt_i)) != -1)
+    while((opt = getopt_long(argc, argv, "m:f:tb:Fsv:rpag:u:G:SPx:V", long_opts, &opt_i)) != -1)
     {
         switch(opt)
         {
@@ -84,8 +232,70 @@ int main(int argc, char *argv[])
         case 't':
             printFrameTimes = true;
             break;
+        case 'b':
+            benchFrames = atoi(optarg);
+            break;
+        case 'F':
+            fullUpload = true;
+            break;
+        case 'S':
+            streamUpload = true;
+            fullUpload = true;
+            break;
+        case 'P':
+            palettePack = true;
+            break;
+        case 'V':
+            verifyUpload = true;
+            break;
+        case 'x':
+            if (sscanf(optarg, "%d:%d", &scrollStepX, &scrollStepY) != 2) {
+                printf("ERROR: --scroll takes DX:DY\n");
+                return 1;
+            }
+            break;
+        case 's':
+            swapBuffers = true;
+            break;
+        case 'v':
+            vsyncFrames = atoi(optarg);
+            break;
+        case 'r':
+            raceBeam = true;
+            break;
+        case 'p':
+            densePack = true;
+            break;
+        case 'a':
+            asyncUpload = true;
+            break;
+        case 'g':
+            gammaCorrect = true;
+            pixelGammaInit(&frameGamma, atof(optarg));
+            break;
+        case 'u':
+            bcmUnit = atoi(optarg);
+            if (bcmUnit < 1 || bcmUnit > 255) {
+                printf("ERROR: --bcm-unit takes 1-255 matrix clocks\n");
+                return 1;
+            }
+            break;
+        case 'G':
+            if (sscanf(optarg, "%dx%d", &screenWidth, &screenHeight) != 2 || screenWidth <= 0 || screenHeight <= 0) {
+                printf("ERROR: --geometry takes WIDTHxHEIGHT\n");
+                return 1;
+            }
+            break;
         }
     }
+    if (asyncUpload && (swapBuffers || raceBeam || streamUpload || scrollStepX || scrollStepY || verifyUpload)) {
+        printf("ERROR: --async only does full and delta uploads, not --swap, --race, --stream, --scroll or --verify\n");
+        return 1;
+    }
+    if (palettePack && ((mode != 6 && benchFrames == 0) || gammaCorrect || densePack)) {
+        printf("ERROR: --palette is only for the fire effect (-m 6) and without --gamma or --rgb565\n");
+        return 1;
+    }
 
     //Handle image loading
     if (IsFileExtension(filename, ".png")) { // see if we are loading an image or an animation
@@ -104,94 +314,127 @@ int main(int argc, char *argv[])
         printf("ERROR: GPMC Bridge Init failed");
         return 2;
     }
+    if (swapBuffers && !bridge_double_buffered(&br)) {
+        printf("ERROR: --swap needs a bitstream built with DOUBLE_BUFFER, this one has a single frame buffer\n");
+        bridge_close(&br);
+        return 1;
+    }
+    if (palettePack && !bridge_has_palette(&br)) {
+        printf("ERROR: --palette needs a bitstream built with PALETTE, this one has no palette\n");
+        bridge_close(&br);
+        return 1;
+    }
+    struct bridge_geometry geo;
+    if (bridge_geometry(&br, &geo) == 0) {
+        if (screenWidth == 0) {
+            screenWidth = geo.width;
+            screenHeight = geo.height;
+        }
+        bcmBits = geo.bcm_bits;
+    }
+    else if (screenWidth == 0) {
+        screenWidth = DEFAULT_WIDTH;
+        screenHeight = DEFAULT_HEIGHT;
+    }
+    numPixels = screenWidth * screenHeight;
+    frameWords = palettePack ? numPixels / 2 : densePack ? numPixels : numPixels * 2;
+    if (((mode == 0) || (benchFrames > 0)) && ((img.width != screenWidth) || (img.height != screenHeight))) {
+        printf("ERROR: %s is %dx%d, the screen is %dx%d\n", filename, img.width, img.height, screenWidth, screenHeight);
+        return 1;
+    }
+    if ((bridge_shadow_init(&frameShadow[0], FPGA_MEM_OFFSET, frameWords) < 0) ||
+        (bridge_shadow_init(&frameShadow[1], FPGA_MEM_OFFSET, frameWords) < 0)) {
+        printf("ERROR: Frame shadow allocation failed, or the frame doesn't fit the GPMC window\n");
+        return 2;
+    }
+    set_word(&br, BW_REG_ADR(BW_REG_CTRL), palettePack ? BW_CTRL_PALETTE : densePack ? BW_CTRL_RGB565 : 0); // tell the FPGA how to unpack
+    if (bcmUnit > 0) bridge_set_timing(&br, bcmUnit, 0);
 
-    int currentFrame = 0;
+    printf("Screen: %dx%d, Number of Frames: %d\n", screenWidth, screenHeight, numFrames);
 
-    printf("Number of Frames: %d\n", numFrames);
+    initScenes();
+    cacheImageFrames();
+    if (palettePack) bridge_set_palette(&br, 0, fire565, 256);
 
-    // Set up a timer to have a controllable frame time
-    volatile bool change_frame = 0;
-    pthread_t frame_timer_thread_id;
-    pthread_create(&frame_timer_thread_id, NULL, FrameTimerThread, (bool*)&change_frame);
-    
-    struct timespec ts;
+    if (benchFrames > 0) {
+        runBenchmark(&br, benchFrames);
+        bridge_close(&br);
+        UnloadImage(img);
+        return 0;
+    }
+
+    // Render ahead into a ring of frames, a separate thread uploads them on the frame deadlines
+    if (frameRingInit(&frameQueue, frameWords) < 0) {
+        printf("ERROR: Frame ring allocation failed");
+        return 2;
+    }
+    if (asyncUpload && (bridge_async_init(&uploadEngine, &br) < 0)) {
+        printf("ERROR: Async upload engine init failed");
+        return 2;
+    }
+    pthread_t upload_thread_id;
+    pthread_create(&upload_thread_id, NULL, UploadThread, &br);
+
+    // Frame time statistics, summarised every FRAMETIME_REPORT frames
+    static frameHist renderTimes;
+    frameHistReset(&renderTimes);
     uint64_t us = 0;
 
+    // display our frames
+    do {
+        uint16_t* matrixData = frameRingAcquire(&frameQueue);
+
+        if (printFrameTimes) {
+            us = frameTimeUs();
+        }
+
+        renderFrame(mode);
+        frameRingPublish(&frameQueue, packFrame(mode, matrixData));
+
+        if (printFrameTimes) {
+            frameHistAdd(&renderTimes, frameTimeUs() - us);
+            if (renderTimes.count == FRAMETIME_REPORT) {
+                frameHistPrint(&renderTimes, "frame", stdout);
+                frameHistReset(&renderTimes);
+            }
+        }
+
+    } while (1);
+
+    frameRingFree(&frameQueue);
+    bridge_close(&br);
+    UnloadImage(img);         // Unload CPU (RAM) image data (pixels)
+    free(imgFrames);
+
+    return 0;
+}
+
+void initScenes(void) {
     // 2d shape
     // for SW rendering make a frame buffer
-    Image fbuf = GenImageColor(64, 64, BLACK); 
-    // Other SW rendering objects
-    //lets represent a wireframe shape as some vectors
-    Vector2 vertices[] = {{-16.0, -8.0}, {16.0, -8.0}, {0.0, 8.0}};
-    int lineIndices[] = {0, 1, 1, 2, 2, 0};
-    shape2d triangle = {
-        .numVertices = 3,
-        .numLines = 3,
-        .vertices = vertices,
-        .lineIndices = lineIndices
-    };
-
-    float angle = 0;
-
-    // 3d shape
-    // Triangular prism
-    shape3d triangularPrism = {
-        .numFaces = 5,
-        .vertices = (Vector3[]){{0, 16, 0}, {-16, -16, -16}, {16, -16, -16}, {16, -16, 16}, {-16, -16, 16}},
-        .faceVertices = (int[]){
-            0, 2, 1,   // Face 1
-            0, 3, 2,   // Face 2
-            0, 4, 3,   // Face 3
-            0, 1, 4,   // Face 4
-            4, 1, 2, 3 // Face 5 (square)
-        },
-        .numVerticesPerFace = (int[]){3, 3, 3, 3, 4}
-    };
+    fbuf = GenImageColor(screenWidth, screenHeight, BLACK); 
 
-    Mesh sphereMesh = GenMeshSphere(30, 4, 8);
-    shape3d sphere = rlMesh2Shape3d(sphereMesh);
+    // 3d shapes
+    sphere = rlMesh2Shape3d(GenMeshSphere(30, 4, 8));
 
     int heightMapX = 150;
     int heightMapY = 20;
     int heightMapZ = 150;
     Mesh heightMapMesh = GenMeshHeightmap(img, (Vector3) {heightMapX,heightMapY,heightMapZ});
-    shape3d heightMap = rlMesh2Shape3d(heightMapMesh);
+    heightMap = rlMesh2Shape3d(heightMapMesh);
     for (int i = 0; i < heightMapMesh.vertexCount; i++) {
         heightMap.vertices[i].x = heightMap.vertices[i].x - heightMapX / 2;
         heightMap.vertices[i].y = heightMap.vertices[i].y - heightMapY / 2;
         heightMap.vertices[i].z = heightMap.vertices[i].z - heightMapZ / 2;
     }
-    
-    // Cube
-    shape3d cube = {
-        .numFaces = 6,
-        .vertices = (Vector3[]){
-            {-16,  16,  16}, // 0
-            { 16,  16,  16}, // 1
-            { 16, -16,  16}, // 2
-            {-16, -16,  16}, // 3
-            {-16,  16, -16}, // 4
-            { 16,  16, -16}, // 5
-            { 16, -16, -16}, // 6
-            {-16, -16, -16}  // 7
-        },
-        .faceVertices = (int[]){
-            0, 3, 2, 1, // Front face
-            4, 5, 6, 7, // Back face
-            0, 1, 5, 4, // Top face
-            2, 3, 7, 6, // Bottom face
-            0, 4, 7, 3, // Left face
-            1, 2, 6, 5  // Right face
-        },
-        .numVerticesPerFace = (int[]){4, 4, 4, 4, 4, 4}
-    };
-
-    Vector3 rotationAngles = {0.0,0.0,0.0};
-    Vector3 rotatedAngle;
 
     // Fire effect data
-    Color colors[NUMPIXELS];
-
+    fire = calloc(numPixels, sizeof(uint8_t));
+    fireRGBA = malloc(numPixels * sizeof(Color));
+    if ((fire == NULL) || (fireRGBA == NULL)) {
+        printf("ERROR: Not enough memory for the fire effect\n");
+        exit(1);
+    }
     for (int i = 0; i < 32; ++i) {
         /* black to mid red, 32 values*/
         // colors[i].r = i << 2; // make the last red section decay linearly
@@ -225,16 +468,14 @@ int main(int argc, char *argv[])
         colors[i + 224].g = 255;
         colors[i + 224].b = 224 + i;
     } 
+    pixelPaletteInit(&firePalette, (const uint8_t *)colors);
+    pixelPack565(fire565, (const uint8_t *)colors, 256);
 
     // Starfield effect
     init_starfield();	
 
-    int i,j; 
-    uint16_t temp;
-    uint8_t index;
-
     fastObjMesh* objmesh = fast_obj_read("../media/fox.obj");
-    shape3d obj = {
+    obj = (shape3d) {
         .numFaces = objmesh->face_count,
         .vertices = malloc(objmesh->index_count*sizeof(Vector3)),
         .faceVertices = malloc(objmesh->index_count*sizeof(int)),
@@ -248,224 +489,346 @@ int main(int argc, char *argv[])
             obj.faceVertices[n*3 + m] = n*3 + m;
         }
     }
-    
-    // display our frames
-    uint16_t matrixData[NUMPIXELS * 2];
-    do {
-        if (printFrameTimes) {
-            clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
-            us = (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
-        }
-
-        switch (mode) {
-            case 0: // display image/gif
-                loadMatrixData(matrixData, &img, currentFrame);
-                currentFrame++;
-                if (currentFrame >= numFrames) currentFrame = 0;
-                break;
+}
 
-            case 1: // 2d shape
+// Update the rotation angles
+static void spinShape(void) {
+    rotationAngles.x += 1.0;
+    rotationAngles.y += 1.0;
+    rotationAngles.z += 0.5;
 
-                // make a 2d shape and draw it
-                ImageClearBackground(&fbuf,BLACK);
-                drawShape2d(&fbuf, &triangle, 31, 31, angle, BLUE);
-                angle += 2;
-                if (angle > 360) angle -= 360;
+    if (rotationAngles.x >= 360) rotationAngles.x -= 360;
+    if (rotationAngles.y >= 360) rotationAngles.y -= 360;
+    if (rotationAngles.z >= 360) rotationAngles.z -= 360;
+}
 
-                loadMatrixData(matrixData, &fbuf, 0);
-                break;
+// Update the rotation angles for the tilted turntable modes
+static void turnShape(void) {
+    rotationAngles.x = 180;
+    rotationAngles.y += 1.0;
+    rotationAngles.z = 0.0;
 
-            case 2: // 3d prism
-                // Draw the 3D shape
-                ImageClearBackground(&fbuf, BLACK);
-                drawShape3dCulled(&fbuf, &triangularPrism, 31, 31, rotationAngles, BLUE);
+    if (rotationAngles.x >= 360) rotationAngles.x -= 360;
+    if (rotationAngles.y >= 360) rotationAngles.y -= 360;
+    if (rotationAngles.z >= 360) rotationAngles.z -= 360;
+}
 
-                // Update the rotation angles
-                rotationAngles.x += 1.0;
-                rotationAngles.y += 1.0;
-                rotationAngles.z += 0.5;
+static void updateFire(void) {
+    int i,j; 
+    uint16_t temp;
+    int index;
 
-                if (rotationAngles.x >= 360) rotationAngles.x -= 360;
-                if (rotationAngles.y >= 360) rotationAngles.y -= 360;
-                if (rotationAngles.z >= 360) rotationAngles.z -= 360;
+    // credit to https://demo-effects.sourceforge.net/ for this algorithm, I just modified the color palette
 
-                // Copy the pixels to matrixData
-                loadMatrixData(matrixData, &fbuf, 0);
-                break;
+    /* draw random bottom line in fire array*/
+    j = screenWidth * (screenHeight- 1);
+    for (i = 0; i < screenWidth - 1; i++)
+    {
+    int random = 1 + (int)(16.0 * (rand()/(RAND_MAX+1.0)));
+    if (random > 9) /* the lower the value, the intenser the fire, compensate a lower value with a higher decay value*/
+        fire[j + i] = 255; /*maximum heat*/
+    else
+        fire[j + i] = 0;
+    }  
+    
+    /* move fire upwards, start at bottom*/
+    
+    for (index = 0; index < screenHeight - 1 ; ++index) {
+        for (i = 0; i < screenWidth - 1; ++i) {
+            if (i == 0) { /* at the left border*/
+                temp = fire[j];
+                temp += fire[j + 1];
+                temp += fire[j - screenWidth];
+                temp /=3;
+            }
+            else if (i == screenWidth - 1) { /* at the right border*/
+                temp = fire[j + i];
+                temp += fire[j - screenWidth + i];
+                temp += fire[j + i - 1];
+                temp /= 3;
+            }
+            else {
+                temp = fire[j + i];
+                temp += fire[j + i + 1];
+                temp += fire[j + i - 1];
+                temp += fire[j - screenWidth + i];
+                temp >>= 2;
+            }
+            if (temp > 1) {
+                temp -= 1; /* decay */
+                if (temp%10 == 0) temp -= 1; // scale it down slightly so it doesn't hit the top edge
+            }
+            else temp = 0;
+
+            fire[j - screenWidth + i] = temp;
+        }
+        j -= screenWidth;
+    }
+}
 
-            case 3: // 3d cube
-                // Draw the 3D shape
-                ImageClearBackground(&fbuf, BLACK);
-                drawShape3dCulled(&fbuf, &cube, 31, 31, rotationAngles, BLUE);
+// Render the next frame of a mode into fbuf, or into the effect state for modes that don't use an Image
+void renderFrame(int mode) {
+    switch (mode) {
+        case 0: // display image/gif
+            imgFrame = currentFrame;
+            currentFrame++;
+            if (currentFrame >= numFrames) currentFrame = 0;
+            break;
 
-                // Update the rotation angles
-                rotationAngles.x += 1.0;
-                rotationAngles.y += 1.0;
-                rotationAngles.z += 0.5;
+        case 1: // 2d shape
 
-                if (rotationAngles.x >= 360) rotationAngles.x -= 360;
-                if (rotationAngles.y >= 360) rotationAngles.y -= 360;
-                if (rotationAngles.z >= 360) rotationAngles.z -= 360;
+            // make a 2d shape and draw it
+            ImageClearBackground(&fbuf,BLACK);
+            drawShape2d(&fbuf, &triangle, screenWidth/2 - 1, screenHeight/2 - 1, angle, BLUE);
+            angle += 2;
+            if (angle > 360) angle -= 360;
+            break;
 
-                // Copy the pixels to matrixData
-                loadMatrixData(matrixData, &fbuf, 0);
-                break;
+        case 2: // 3d prism
+            // Draw the 3D shape
+            ImageClearBackground(&fbuf, BLACK);
+            drawShape3dCulled(&fbuf, &triangularPrism, screenWidth/2 - 1, screenHeight/2 - 1, rotationAngles, BLUE);
+            spinShape();
+            break;
 
-            case 4: // 3d sphere
-                // Draw the 3D shape
-                ImageClearBackground(&fbuf, BLACK);
-                drawShape3dCulled(&fbuf, &sphere, 31, 31, rotationAngles, BLUE);
+        case 3: // 3d cube
+            // Draw the 3D shape
+            ImageClearBackground(&fbuf, BLACK);
+            drawShape3dCulled(&fbuf, &cube, screenWidth/2 - 1, screenHeight/2 - 1, rotationAngles, BLUE);
+            spinShape();
+            break;
 
-                // Update the rotation angles
-                rotationAngles.x += 1.0;
-                rotationAngles.y += 1.0;
-                rotationAngles.z += 0.5;
+        case 4: // 3d sphere
+            // Draw the 3D shape
+            ImageClearBackground(&fbuf, BLACK);
+            drawShape3dCulled(&fbuf, &sphere, screenWidth/2 - 1, screenHeight/2 - 1, rotationAngles, BLUE);
+            spinShape();
+            break;
 
-                if (rotationAngles.x >= 360) rotationAngles.x -= 360;
-                if (rotationAngles.y >= 360) rotationAngles.y -= 360;
-                if (rotationAngles.z >= 360) rotationAngles.z -= 360;
+        case 5: // 3d heightMap
+            // Draw the 3D shape
+            ImageClearBackground(&fbuf, BLACK);
+            rotatedAngle = QuaternionToEuler(QuaternionMultiply(QuaternionFromEuler(-25 * M_PI / 180,0,0),QuaternionFromEuler(rotationAngles.x * M_PI / 180, rotationAngles.y * M_PI / 180, rotationAngles.z * M_PI / 180)));
+            drawShape3dCulled(&fbuf, &heightMap, screenWidth/2 - 1, screenHeight/2 - 12, Vector3Scale(rotatedAngle, 180 / M_PI), BLUE);
+            turnShape();
+            break;
 
-                // Copy the pixels to matrixData
-                loadMatrixData(matrixData, &fbuf, 0);
-                break;
+        case 6: // fire effect
+            updateFire();
+            break;
 
-            case 5: // 3d heightMap
-                // Draw the 3D shape
-                ImageClearBackground(&fbuf, BLACK);
-                rotatedAngle = QuaternionToEuler(QuaternionMultiply(QuaternionFromEuler(-25 * M_PI / 180,0,0),QuaternionFromEuler(rotationAngles.x * M_PI / 180, rotationAngles.y * M_PI / 180, rotationAngles.z * M_PI / 180)));
-                drawShape3dCulled(&fbuf, &heightMap, 31, 20, Vector3Scale(rotatedAngle, 180 / M_PI), BLUE);
+        case 7: // obj
+            // Draw the obj
+            ImageClearBackground(&fbuf, BLACK);
+            rotatedAngle = QuaternionToEuler(QuaternionMultiply(QuaternionFromEuler(-25 * M_PI / 180,0,0),QuaternionFromEuler(rotationAngles.x * M_PI / 180, rotationAngles.y * M_PI / 180, rotationAngles.z * M_PI / 180)));
+            drawShape3dCulled(&fbuf, &obj, screenWidth/2 - 1, screenHeight/2 + 18, Vector3Scale(rotatedAngle, 180 / M_PI), ORANGE);
+            turnShape();
+            break;
 
-                // Update the rotation angles
-                rotationAngles.x = 180;
-                rotationAngles.y += 1.0;
-                rotationAngles.z = 0.0;
+        case 8: // Star field
+            update_starfield();
+            break;
+    }
+}
 
-                if (rotationAngles.x >= 360) rotationAngles.x -= 360;
-                if (rotationAngles.y >= 360) rotationAngles.y -= 360;
-                if (rotationAngles.z >= 360) rotationAngles.z -= 360;
+// Pack every frame of the image/gif once, the result never changes
+void cacheImageFrames(void) {
+    if (gammaCorrect || palettePack) return; // the dither changes every frame, pack as they are shown
+    imgFrames = malloc((size_t)numFrames * frameWords * sizeof(uint16_t));
+    if (imgFrames == NULL) {
+        printf("ERROR: Not enough memory to cache %d frames\n", numFrames);
+        exit(1);
+    }
+    for (int n = 0; n < numFrames; n++) {
+        loadMatrixData(&imgFrames[n * frameWords], &img, n);
+    }
+}
 
-                // Copy the pixels to matrixData
-                loadMatrixData(matrixData, &fbuf, 0);
+// Convert the rendered frame to the GPMC word layout, returns the words to upload
+const uint16_t* packFrame(int mode, uint16_t* matrixData) {
+    switch (mode) {
+        case 0:
+            if (gammaCorrect) {
+                loadMatrixData(matrixData, &img, imgFrame);
                 break;
-
-            case 6: // fire effect
-                // credit to https://demo-effects.sourceforge.net/ for this algorithm, I just modified the color palette
-
-                /* draw random bottom line in fire array*/
-                j = SCREEN_WIDTH * (SCREEN_HEIGHT- 1);
-                for (i = 0; i < SCREEN_WIDTH - 1; i++)
-                {
-                int random = 1 + (int)(16.0 * (rand()/(RAND_MAX+1.0)));
-                if (random > 9) /* the lower the value, the intenser the fire, compensate a lower value with a higher decay value*/
-                    fire[j + i] = 255; /*maximum heat*/
-                else
-                    fire[j + i] = 0;
-                }  
-                
-                /* move fire upwards, start at bottom*/
-                
-                for (index = 0; index < 63 ; ++index) {
-                    for (i = 0; i < SCREEN_WIDTH - 1; ++i) {
-                        if (i == 0) { /* at the left border*/
-                            temp = fire[j];
-                            temp += fire[j + 1];
-                            temp += fire[j - SCREEN_WIDTH];
-                            temp /=3;
-                        }
-                        else if (i == SCREEN_WIDTH - 1) { /* at the right border*/
-                            temp = fire[j + i];
-                            temp += fire[j - SCREEN_WIDTH + i];
-                            temp += fire[j + i - 1];
-                            temp /= 3;
-                        }
-                        else {
-                            temp = fire[j + i];
-                            temp += fire[j + i + 1];
-                            temp += fire[j + i - 1];
-                            temp += fire[j - SCREEN_WIDTH + i];
-                            temp >>= 2;
-                        }
-                        if (temp > 1) {
-                            temp -= 1; /* decay */
-                            if (temp%10 == 0) temp -= 1; // scale it down slightly so it doesn't hit the top edge
-                        }
-                        else temp = 0;
-
-                        fire[j - SCREEN_WIDTH + i] = temp;
-                    }
-                    j -= SCREEN_WIDTH;
-                }
-
-                // not using an Image for drawing, load matrixData
-                for (int i = 0; i < NUMPIXELS; i++) {
-                    (matrixData)[i*2] = (colors[fire[i]].g) << 8 | (colors[fire[i]].r);
-                    (matrixData)[i*2+1] = (colors[fire[i]].b);
-                }
+            }
+            // already packed at load time
+            return &imgFrames[imgFrame * frameWords];
+
+        case 6:
+            // not using an Image for drawing, load matrixData
+            if (palettePack) {
+                memcpy(matrixData, fire, numPixels); // pixel 2i in the low byte of word i
                 break;
+            }
+            if (gammaCorrect) {
+                for (int i = 0; i < numPixels; i++) fireRGBA[i] = colors[fire[i]];
+                pixelPackGamma(matrixData, (const uint8_t *)fireRGBA, screenWidth, screenHeight, &frameGamma, ditherFrame++, densePack, bcmBits);
+                break;
+            }
+            pixelPackPalette(matrixData, fire, &firePalette, numPixels, densePack);
+            break;
 
-            case 7: // obj
-                // Draw the obj
-                ImageClearBackground(&fbuf, BLACK);
-                rotatedAngle = QuaternionToEuler(QuaternionMultiply(QuaternionFromEuler(-25 * M_PI / 180,0,0),QuaternionFromEuler(rotationAngles.x * M_PI / 180, rotationAngles.y * M_PI / 180, rotationAngles.z * M_PI / 180)));
-                drawShape3dCulled(&fbuf, &obj, 31, 50, Vector3Scale(rotatedAngle, 180 / M_PI), ORANGE);
-
-                // Update the rotation angles
-                rotationAngles.x = 180;
-                rotationAngles.y += 1.0;
-                rotationAngles.z = 0.0;
+        case 8:
+            draw_starfield(matrixData);
+            break;
 
-                if (rotationAngles.x >= 360) rotationAngles.x -= 360;
-                if (rotationAngles.y >= 360) rotationAngles.y -= 360;
-                if (rotationAngles.z >= 360) rotationAngles.z -= 360;
+        default:
+            // Copy the pixels to matrixData
+            loadMatrixData(matrixData, &fbuf, 0);
+            break;
+    }
+    return matrixData;
+}
 
-                // Copy the pixels to matrixData
-                loadMatrixData(matrixData, &fbuf, 0);
-                break;
+// Run every mode headless for benchFrames frames, timing render, pack and upload separately
+void runBenchmark(struct bridge* br, int benchFrames) {
+    static frameHist renderTimes, packTimes, uploadTimes, totalTimes;
+    uint16_t* matrixData = malloc(numPixels * 2 * sizeof(uint16_t));
+    const uint16_t* frameData;
+    uint64_t t0, t1, t2, t3;
+
+    printf("Benchmark: %d frames per mode, %d us frame budget\n", benchFrames, FRAME_BUDGET_US);
+    for (int mode = 0; mode < NUM_MODES; mode++) {
+        if (palettePack && (mode != 6)) continue; // no palette for the other modes
+        frameHistReset(&renderTimes);
+        frameHistReset(&packTimes);
+        frameHistReset(&uploadTimes);
+        frameHistReset(&totalTimes);
+        bridge_reset_stats(br);
+        bridge_shadow_invalidate(&frameShadow[0]);
+        bridge_shadow_invalidate(&frameShadow[1]);
+
+        for (int n = 0; n < benchFrames; n++) {
+            t0 = frameTimeUs();
+            renderFrame(mode);
+            t1 = frameTimeUs();
+            frameData = packFrame(mode, matrixData);
+            t2 = frameTimeUs();
+            uploadFrame(br, frameData);
+            t3 = frameTimeUs();
+
+            frameHistAdd(&renderTimes, t1 - t0);
+            frameHistAdd(&packTimes, t2 - t1);
+            frameHistAdd(&uploadTimes, t3 - t2);
+            frameHistAdd(&totalTimes, t3 - t0);
+        }
 
-            case 8: // Star field
-                update_starfield();
-                draw_starfield(matrixData);
-                break;
+        printf("\nmode %d: %.2f%% of frames over budget\n", mode,
+               100.0 * frameHistOver(&totalTimes, FRAME_BUDGET_US) / totalTimes.count);
+        frameHistPrint(&renderTimes, "render", stdout);
+        frameHistPrint(&packTimes, "pack", stdout);
+        frameHistPrint(&uploadTimes, "upload", stdout);
+        frameHistPrint(&totalTimes, "total", stdout);
+        printf("upload   %.0f words/frame\n", (double)br->wr_stats.words / benchFrames);
+    }
+    printf("\n");
+    bridge_print_stats(br, stdout);
+    free(matrixData);
+}
 
-        }
+// Wait for the panel to finish its vsyncFrames'th refresh since the last upload,
+// returns how many extra refreshes went by because the upload ran long
+int vsyncWait(struct bridge* br, uint16_t* lastFrame) {
+    uint16_t elapsed;
 
-        if (printFrameTimes) {
-            clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
-            printf("%llu us\n",(uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000 - us);
+    do {
+        if (bridge_wait_frame(br, SWAP_TIMEOUT_US) < 0) {
+            printf("No frame boundary from the FPGA, is the bitstream loaded?\n");
         }
+        elapsed = bridge_frame_count(br) - *lastFrame;
+    } while (elapsed < vsyncFrames);
+    *lastFrame += elapsed;
+    return elapsed - vsyncFrames;
+}
 
-        // At this point we should have our data ready in matrixData
-        if (change_frame) printf("Frame not ready!\n");
-        while (!change_frame){
-        };
-        
-        set_fpga_mem(&br, FPGA_MEM_OFFSET, matrixData, NUMPIXELS*2);
-        change_frame = 0;
+// Async completion, runs on the engine's worker thread
+static void uploadDone(struct bridge_xfer* xfer) {
+    (void)xfer;
+    frameRingRelease(&frameQueue);
+}
 
-    } while (1);
+// Queue the oldest rendered frame on the async engine, the ring slot is released once it is written
+static void submitFrame(const uint16_t* matrixData) {
+    uploadXfer.reg_addr = FPGA_MEM_OFFSET;
+    uploadXfer.source = matrixData;
+    uploadXfer.reg_num = frameWords;
+    uploadXfer.sh = fullUpload ? NULL : &frameShadow[0];
+    uploadXfer.done = uploadDone;
+    bridge_async_submit(&uploadEngine, &uploadXfer);
+}
 
-    bridge_close(&br);
-    UnloadImage(img);         // Unload CPU (RAM) image data (pixels)
+// Upload the oldest rendered frame at every frame deadline
+void *UploadThread(void *vargp) {
+    struct bridge* br = vargp;
+    struct sched_param param = { .sched_priority = 10 };
+    framePacer pacer;
+    int64_t lateNs;
+    uint32_t missed = 0;
+    uint16_t lastFrame;
+    int skipped;
+    bool inFlight = false;
+    const uint16_t* frameData;
+
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param); // best effort, needs root like /dev/mem does
+
+    framePacerInit(&pacer, FRAMETIME_US);
+    lastFrame = bridge_frame_count(br);
+    while (1) {
+        if (vsyncFrames > 0) {
+            // follow the panel's own refresh so the two clocks can't beat against each other
+            pacer.frames++;
+            skipped = vsyncWait(br, &lastFrame);
+            if (skipped > 0) printf("Upload %d refreshes late (%u of %u frames)\n", skipped, ++pacer.overruns, pacer.frames);
+        }
+        else {
+            lateNs = framePacerWait(&pacer);
+            if (lateNs > 0) printf("Upload %lld us late (%u of %u frames)\n", (long long)(lateNs / 1000), pacer.overruns, pacer.frames);
+        }
 
-    return 0;
-}
+        // The previous async upload still owns the oldest slot until it completes
+        if (inFlight) {
+            if (bridge_async_wait(&uploadEngine, 0) <= 0) {
+                printf("Upload still running! (%u of %u frames)\n", ++missed, pacer.frames);
+                continue;
+            }
+            inFlight = false;
+        }
 
-void *FrameTimerThread(void *vargp) {
-    const struct timespec frametimer = {0 , FRAMETIME_US};
-    while(1) {
-        nanosleep(&frametimer, NULL); //frame time
-        *(bool*)(vargp) = 1; //new character ready
+        // At this point the render thread should have a frame ready, otherwise the FPGA keeps the last one
+        frameData = frameRingPeek(&frameQueue);
+        if (frameData == NULL) {
+            printf("Frame not ready! (%u of %u frames)\n", ++missed, pacer.frames);
+            continue;
+        }
+        if (asyncUpload) {
+            submitFrame(frameData);
+            inFlight = true;
+            continue;
+        }
+        uploadFrame(br, frameData);
+        frameRingRelease(&frameQueue);
     }
     return NULL;
 }
 
+// Stars live in a box as wide and high as the screen and as deep as its longer side, and are
+// projected with the depth as the focal length, so the field keeps its look on chained panels
+static int star_depth() {
+    return screenWidth > screenHeight ? screenWidth : screenHeight;
+}
+
+static void spawn_star(Star* star, float z) {
+    star->x = rand() % screenWidth - screenWidth / 2;
+    star->y = rand() % screenHeight - screenHeight / 2;
+    star->z = z;
+    star->velocity = 1 + (rand() % 10) / 10.0;
+}
+
 // Initialize starfield
 void init_starfield() {
     for (int i = 0; i < NUM_STARS; i++) {
-        stars[i].x = rand() % 64 - 32;
-        stars[i].y = rand() % 64 - 32;
-        stars[i].z = rand() % 64;
-        stars[i].velocity = 1 + (rand() % 10) / 10.0;
+        spawn_star(&stars[i], rand() % star_depth());
     }
 }
 
@@ -475,34 +838,81 @@ void update_starfield() {
         stars[i].z -= stars[i].velocity;
 
         if (stars[i].z <= 0) {
-            stars[i].x = rand() % 64 - 32;
-            stars[i].y = rand() % 64 - 32;
-            stars[i].z = 64;
-            stars[i].velocity = 1 + (rand() % 10) / 10.0;
+            spawn_star(&stars[i], star_depth());
         }
     }
 }
 
 // Draw starfield
 void draw_starfield(uint16_t* matrixData) {
-    memset(matrixData, 0, 64 * 64 * 2 * sizeof(uint16_t)); // Clear matrixData
+    float focal = star_depth() / 2;
+
+    memset(matrixData, 0, frameWords * sizeof(uint16_t)); // Clear matrixData
 
     for (int i = 0; i < NUM_STARS; i++) {
-        int x = (int)((stars[i].x / stars[i].z) * 32 + 32);
-        int y = (int)((stars[i].y / stars[i].z) * 32 + 32);
+        int x = (int)((stars[i].x / stars[i].z) * focal + screenWidth / 2);
+        int y = (int)((stars[i].y / stars[i].z) * focal + screenHeight / 2);
 
-        if (x >= 0 && x < 64 && y >= 0 && y < 64) {
-            int j = y * 64 + x;
-            (matrixData)[j * 2] = (0xFF) << 8 | (0xFF); // G and R components
-            (matrixData)[j * 2 + 1] = (0xFF); // B component
+        if (x >= 0 && x < screenWidth && y >= 0 && y < screenHeight) {
+            int j = y * screenWidth + x;
+            packPixel(matrixData, j, 0xFF, 0xFF, 0xFF);
         }
     }
 }
 
+// Send a packed frame to the FPGA, skipping the spans it already holds
+void uploadFrame(struct bridge* br, const uint16_t* matrixData) {
+    // the back bank holds the frame from two swaps ago, so each bank needs its own shadow
+    int bank = swapBuffers ? bridge_back_bank(br) : 0;
+
+    if (verifyUpload) bridge_crc_reset(br); // the CRC then covers just this upload, however many words it writes
+    if (streamUpload) {
+        set_fpga_mem_stream(br, FPGA_MEM_OFFSET, matrixData, frameWords);
+    }
+    else if (fullUpload) {
+        set_fpga_mem(br, FPGA_MEM_OFFSET, matrixData, frameWords);
+    }
+    else if (raceBeam) {
+        set_fpga_mem_scan(br, &frameShadow[bank], matrixData, frameWords / screenHeight);
+    }
+    else {
+        set_fpga_mem_delta(br, &frameShadow[bank], matrixData);
+    }
+    // before the swap, which restarts the CRC
+    if (verifyUpload && (bridge_verify_crc(br) < 0)) {
+        printf("Frame upload CRC mismatch (%u frames)\n", ++verifyFailed);
+    }
+    if (swapBuffers && (bridge_swap_buffers(br, SWAP_TIMEOUT_US) < 0)) {
+        printf("Frame buffer swap timed out\n");
+    }
+    if (scrollStepX || scrollStepY) {
+        scrollX += scrollStepX;
+        scrollY += scrollStepY;
+        bridge_set_scroll(br, scrollX, scrollY); // only the low bits are used, so the counters just wrap
+    }
+}
+
+// Store pixel i in the selected transfer format
+static inline void packPixel(uint16_t* matrixData, int i, uint8_t r, uint8_t g, uint8_t b) {
+    if (densePack) {
+        matrixData[i] = (r >> 3) << 11 | (g >> 2) << 5 | (b >> 3);
+    }
+    else {
+        matrixData[i*2] = g << 8 | r;
+        matrixData[i*2+1] = b;
+    }
+}
+
 void loadMatrixData(uint16_t* matrixData, Image* fbuf, int FrameNum) {
-    for (int i = 0; i < NUMPIXELS; i++)
-    {
-        (matrixData)[i*2] = (((uint8_t *)fbuf->data)[i*4+1+FrameNum*NUMPIXELS*4]) << 8 | (((uint8_t *)fbuf->data)[i*4+FrameNum*NUMPIXELS*4]);
-        (matrixData)[i*2+1] = (((uint8_t *)fbuf->data)[i*4+2+FrameNum*NUMPIXELS*4]);
+    const uint8_t* rgba = &((uint8_t *)fbuf->data)[FrameNum*numPixels*4];
+
+    if (gammaCorrect) {
+        pixelPackGamma(matrixData, rgba, screenWidth, screenHeight, &frameGamma, ditherFrame++, densePack, bcmBits);
+    }
+    else if (densePack) {
+        pixelPack565(matrixData, rgba, numPixels);
+    }
+    else {
+        pixelPackLoose(matrixData, rgba, numPixels);
     }
 }
\ No newline at end of file
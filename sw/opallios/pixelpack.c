@@ -0,0 +1,151 @@
+#include <math.h>
+#include <string.h>
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PIXELPACK_NEON 1
+#endif
+#include "pixelpack.h"
+
+static inline uint16_t pack565(uint8_t r, uint8_t g, uint8_t b) {
+    return (r >> 3) << 11 | (g >> 2) << 5 | (b >> 3);
+}
+
+void pixelPackLoose(uint16_t* dst, const uint8_t* rgba, int n) {
+    int i = 0;
+
+#ifdef PIXELPACK_NEON
+    const uint8x16_t zero = vdupq_n_u8(0);
+
+    for (; i + 16 <= n; i += 16) {
+        uint8x16x4_t px = vld4q_u8(&rgba[i*4]); // deinterleave into r, g, b, a lanes
+        uint8x16x2_t rg = vzipq_u8(px.val[0], px.val[1]); // R then G bytes, G<<8|R as little endian words
+        uint8x16x2_t b = vzipq_u8(px.val[2], zero);
+        uint16x8x2_t lo = { { vreinterpretq_u16_u8(rg.val[0]), vreinterpretq_u16_u8(b.val[0]) } };
+        uint16x8x2_t hi = { { vreinterpretq_u16_u8(rg.val[1]), vreinterpretq_u16_u8(b.val[1]) } };
+
+        vst2q_u16(&dst[i*2], lo); // RG, B word pairs for pixels 0-7
+        vst2q_u16(&dst[i*2+16], hi); // and 8-15
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i*2] = rgba[i*4+1] << 8 | rgba[i*4];
+        dst[i*2+1] = rgba[i*4+2];
+    }
+}
+
+void pixelPack565(uint16_t* dst, const uint8_t* rgba, int n) {
+    int i = 0;
+
+#ifdef PIXELPACK_NEON
+    for (; i + 16 <= n; i += 16) {
+        uint8x16x4_t px = vld4q_u8(&rgba[i*4]);
+
+        // put each channel in the top byte, then shift-insert G and B below the top 5 bits of R
+        for (int h = 0; h < 2; h++) {
+            uint8x8_t r = h ? vget_high_u8(px.val[0]) : vget_low_u8(px.val[0]);
+            uint8x8_t g = h ? vget_high_u8(px.val[1]) : vget_low_u8(px.val[1]);
+            uint8x8_t b = h ? vget_high_u8(px.val[2]) : vget_low_u8(px.val[2]);
+            uint16x8_t word = vsriq_n_u16(vshll_n_u8(r, 8), vshll_n_u8(g, 8), 5);
+
+            word = vsriq_n_u16(word, vshll_n_u8(b, 8), 11);
+            vst1q_u16(&dst[i + h*8], word);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = pack565(rgba[i*4], rgba[i*4+1], rgba[i*4+2]);
+    }
+}
+
+void pixelPaletteInit(pixelPalette* pal, const uint8_t* rgba) {
+    for (int i = 0; i < 256; i++) {
+        uint8_t r = rgba[i*4], g = rgba[i*4+1], b = rgba[i*4+2];
+
+        pal->loose[i] = (uint32_t)b << 16 | g << 8 | r;
+        pal->dense[i] = pack565(r, g, b);
+    }
+}
+
+void pixelPackPalette(uint16_t* dst, const uint8_t* index, const pixelPalette* pal, int n, int dense) {
+    if (dense) {
+        for (int i = 0; i < n; i++) {
+            dst[i] = pal->dense[index[i]];
+        }
+    }
+    else {
+        for (int i = 0; i < n; i++) {
+            memcpy(&dst[i*2], &pal->loose[index[i]], sizeof(uint32_t)); // one store for the word pair
+        }
+    }
+}
+
+void pixelGammaInit(pixelGamma* gamma, double exponent) {
+    const double full = (1 << PIXELGAMMA_BITS) - 1;
+
+    for (int i = 0; i < 256; i++) {
+        double in = i / 255.0;
+        double out;
+
+        if (exponent > 0) {
+            out = pow(in, exponent);
+        }
+        else {
+            double l = in * 100.0; // CIE L*
+            out = l <= 8.0 ? l / 903.3 : pow((l + 16.0) / 116.0, 3);
+        }
+        gamma->lut[i] = (uint16_t)(out * full + 0.5);
+    }
+}
+
+// 8x8 ordered dither thresholds, 0-63
+static const uint8_t bayer8[8][8] = {
+    {  0, 32,  8, 40,  2, 34, 10, 42 },
+    { 48, 16, 56, 24, 50, 18, 58, 26 },
+    { 12, 44,  4, 36, 14, 46,  6, 38 },
+    { 60, 28, 52, 20, 62, 30, 54, 22 },
+    {  3, 35, 11, 43,  1, 33,  9, 41 },
+    { 51, 19, 59, 27, 49, 17, 57, 25 },
+    { 15, 47,  7, 39, 13, 45,  5, 37 },
+    { 63, 31, 55, 23, 61, 29, 53, 21 },
+};
+
+// Round a PIXELGAMMA_BITS value down to bits, carrying the dropped part up
+// when it beats the threshold
+static inline uint8_t ditherChannel(uint16_t v, int bits, uint8_t threshold) {
+    int shift = PIXELGAMMA_BITS - bits;
+    int q = v >> shift;
+    int residual = (v & ((1 << shift) - 1)) << 6 >> shift; // scale to 0-63
+
+    if ((residual > threshold) && (q < (1 << bits) - 1)) q++;
+    return q;
+}
+
+void pixelPackGamma(uint16_t* dst, const uint8_t* rgba, int width, int height, const pixelGamma* gamma, unsigned frame, int dense, int bcmBits) {
+    // rotate every threshold by an odd step each frame, so over 64 frames each pixel meets all 64
+    // of them and averages to its full precision value, while each frame still uses every
+    // threshold once per 8x8 tile
+    unsigned rot = frame * PIXELGAMMA_DITHER_STEP;
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t* row = bayer8[y & 7];
+
+        for (int x = 0; x < width; x++) {
+            int i = y * width + x;
+            uint8_t t = (row[x & 7] + rot) & 63;
+            uint16_t r = gamma->lut[rgba[i*4]];
+            uint16_t g = gamma->lut[rgba[i*4+1]];
+            uint16_t b = gamma->lut[rgba[i*4+2]];
+
+            if (dense) {
+                dst[i] = ditherChannel(r, 5, t) << 11 | ditherChannel(g, 6, t) << 5 | ditherChannel(b, 5, t);
+            }
+            else {
+                // the FPGA keeps the top bcmBits of each byte
+                int pad = 8 - bcmBits;
+
+                dst[i*2] = ditherChannel(g, bcmBits, t) << (8 + pad) | ditherChannel(r, bcmBits, t) << pad;
+                dst[i*2+1] = ditherChannel(b, bcmBits, t) << pad;
+            }
+        }
+    }
+}
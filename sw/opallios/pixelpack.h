@@ -0,0 +1,42 @@
+// Packing of RGBA pixels into the GPMC frame memory word formats
+
+#ifndef _PIXELPACK_H_
+#define _PIXELPACK_H_
+
+#include <stdint.h>
+
+// Every palette entry already packed in both formats, so indexed frames pack
+// with one table lookup per pixel
+typedef struct pixelPalette {
+    uint32_t loose[256]; // RG word in the low half, B word in the high half
+    uint16_t dense[256]; // RGB565
+} pixelPalette;
+
+// Loose: G<<8|R then B for every pixel. n is a pixel count, any multiple of
+// 16 goes through NEON when the compiler has it, the rest is scalar.
+void pixelPackLoose(uint16_t* dst, const uint8_t* rgba, int n);
+// Dense: one RGB565 word per pixel
+void pixelPack565(uint16_t* dst, const uint8_t* rgba, int n);
+// rgba holds the 256 palette colours, 4 bytes each like raylib's Color
+void pixelPaletteInit(pixelPalette* pal, const uint8_t* rgba);
+void pixelPackPalette(uint16_t* dst, const uint8_t* index, const pixelPalette* pal, int n, int dense);
+
+// Gamma correction to PIXELGAMMA_BITS, then temporal dithering down to the
+// bcm_bits the FPGA shows (5/6/5 for RGB565). The ordered dither thresholds
+// rotate every frame, so over PIXELGAMMA_DITHER_FRAMES frames each pixel
+// averages to the full precision value instead of banding.
+#define PIXELGAMMA_BITS 12
+#define PIXELGAMMA_DITHER_FRAMES 64
+#define PIXELGAMMA_DITHER_STEP 39 // odd, so the rotation visits every threshold
+
+typedef struct pixelGamma {
+    uint16_t lut[256]; // 8 bit in, PIXELGAMMA_BITS linear light out
+} pixelGamma;
+
+// gamma 0 uses the CIE 1931 lightness curve instead of a power law
+void pixelGammaInit(pixelGamma* gamma, double exponent);
+// bcmBits is the FPGA's bit planes per channel (bridge_geometry), the loose
+// format is quantized to it, RGB565 always to 5/6/5
+void pixelPackGamma(uint16_t* dst, const uint8_t* rgba, int width, int height, const pixelGamma* gamma, unsigned frame, int dense, int bcmBits);
+
+#endif
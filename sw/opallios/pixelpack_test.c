@@ -0,0 +1,92 @@
+// Checks the gamma packer against the FPGA's bit plane count, run with make test
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "pixelpack.h"
+
+#define TEST_WIDTH 16
+#define TEST_HEIGHT 16
+#define TEST_PIXELS (TEST_WIDTH * TEST_HEIGHT)
+#define TEST_TOLERANCE 0.1 // LSB, each pixel's average over a dither cycle
+
+static int failed = 0;
+static int truncationFails = 0; // pixels plain truncation would get wrong, the test is useless without them
+
+// Pack rgba at bcmBits for one dither cycle. The FPGA drops the low 8 - bcmBits
+// of every byte so those must be 0, and every pixel on its own must average to
+// its gamma value.
+static void checkLoose(const pixelGamma* gamma, const uint8_t* rgba, int bcmBits, const char* name) {
+    static uint16_t dst[TEST_PIXELS * 2];
+    double sum[TEST_PIXELS] = { 0 };
+    const int pad = 8 - bcmBits;
+    const uint8_t padMask = (1 << pad) - 1;
+    const double top = (1 << bcmBits) - 1;
+    uint8_t lowBits = 0;
+
+    for (unsigned f = 0; f < PIXELGAMMA_DITHER_FRAMES; f++) {
+        pixelPackGamma(dst, rgba, TEST_WIDTH, TEST_HEIGHT, gamma, f, 0, bcmBits);
+        for (int i = 0; i < TEST_PIXELS; i++) {
+            uint8_t r = dst[i*2], g = dst[i*2] >> 8, b = dst[i*2+1];
+
+            if ((r & padMask) || (g & padMask) || (b & padMask) || (dst[i*2+1] >> 8) || (r != g) || (g != b)) {
+                printf("FAIL: %s, %d planes, pixel %d packed as %04x %04x\n", name, bcmBits, i, dst[i*2], dst[i*2+1]);
+                failed++;
+                return;
+            }
+            lowBits |= r >> pad;
+            sum[i] += r >> pad;
+        }
+    }
+    if (!(lowBits & 1) && (rgba[TEST_PIXELS*4-4] != rgba[0])) {
+        printf("FAIL: %s, %d planes, the lowest plane is never set\n", name, bcmBits);
+        failed++;
+    }
+    for (int i = 0; i < TEST_PIXELS; i++) {
+        double want = gamma->lut[rgba[i*4]] / (double)(1 << (PIXELGAMMA_BITS - bcmBits));
+        double got = sum[i] / PIXELGAMMA_DITHER_FRAMES;
+
+        if (want > top) want = top;
+        if (want - (int)want > TEST_TOLERANCE) truncationFails++;
+        if ((got < want - TEST_TOLERANCE) || (got > want + TEST_TOLERANCE)) {
+            printf("FAIL: %s, %d planes, pixel %d averages %.3f, expected %.3f\n", name, bcmBits, i, got, want);
+            failed++;
+            return;
+        }
+    }
+}
+
+static void fill(uint8_t* rgba, int level) {
+    for (int i = 0; i < TEST_PIXELS; i++) {
+        uint8_t v = level < 0 ? i : level; // negative for a ramp over all 256 levels
+
+        rgba[i*4] = rgba[i*4+1] = rgba[i*4+2] = v;
+        rgba[i*4+3] = 255;
+    }
+}
+
+int main(void) {
+    static uint8_t rgba[TEST_PIXELS * 4];
+    // flat fields put one level on every dither position, the ramp every level on one
+    static const int flats[] = { 1, 20, 77, 128, 200, 254 };
+    char name[32];
+    pixelGamma gamma;
+
+    pixelGammaInit(&gamma, 2.2);
+    for (int bits = 6; bits <= 8; bits++) {
+        fill(rgba, -1);
+        checkLoose(&gamma, rgba, bits, "ramp");
+        for (unsigned k = 0; k < sizeof(flats) / sizeof(flats[0]); k++) {
+            fill(rgba, flats[k]);
+            snprintf(name, sizeof(name), "flat %d", flats[k]);
+            checkLoose(&gamma, rgba, bits, name);
+        }
+    }
+    if (!truncationFails) {
+        printf("FAIL: no test pixel needs the dither\n");
+        failed++;
+    }
+    if (failed) return EXIT_FAILURE;
+    printf("PASS: gamma packing at 6, 7 and 8 planes, %d pixels that truncation gets wrong\n", truncationFails);
+    return EXIT_SUCCESS;
+}
@@ -14,6 +14,9 @@ library matrix;
 use matrix.matrix_pkg.all;
 
 entity Opallios_FPGA_tb is
+    generic (
+        MATRIX_CLK_MHZ : natural := 25 -- HUB75 clock configuration of the DUT, 25, 33, 40 or 50
+    );
 end entity Opallios_FPGA_tb;
 
 architecture rtl of Opallios_FPGA_tb is
@@ -50,9 +53,29 @@ architecture rtl of Opallios_FPGA_tb is
     -- Clock period definitions
     constant GPMC_CLK_period : time := 10 ns;
 
+    -- HUB75 clock period of each MATRIX_CLK_MHZ, the PLL builds run at 66.67 and 80 MHz / 2
+    function Matrix_Clk_Period (mhz : natural) return time is
+    begin
+        case mhz is
+            when 33 => return 30 ns;
+            when 40 => return 25 ns;
+            when 50 => return 20 ns;
+            when others => return 40 ns;
+        end case;
+    end function;
+
+    constant MATRIX_CLK_period : time := Matrix_Clk_Period(MATRIX_CLK_MHZ);
+
+    -- BLANK check, the DUT runs with its reset BCM_UNIT and BCM_BITS
+    constant BCM_UNIT_RST   : natural := 64;
+    constant BCM_BITS_TB    : natural := 6;
+    signal blank_low_time   : time := 0 ns; -- last lit period
+    signal blank_plane      : natural := 0; -- plane it belonged to
+
     component led_matrix_fpga_top is
         generic (
-            DEBUG : boolean := false
+            DEBUG           : boolean := false;
+            MATRIX_CLK_MHZ  : natural := 25
         );
         port (
             -- BeagleWire signals
@@ -122,7 +145,8 @@ begin
 
     DUT: led_matrix_fpga_top
         generic map (
-            DEBUG => DEBUG
+            DEBUG           => DEBUG,
+            MATRIX_CLK_MHZ  => MATRIX_CLK_MHZ
         )
         port map (
             -- BeagleWire signals
@@ -185,6 +209,33 @@ begin
         wait for GPMC_CLK_period/2;
     end process;
 
+    -- Every bit plane must be lit (BLANK low) for BCM_UNIT * 2^plane matrix clocks, in plane
+    -- order from the first latch on, whatever the shift takes
+    p_blank_check : process
+        variable t_low  : time;
+        variable want   : time;
+        variable plane  : natural := 0;
+    begin
+        wait until LATCH = '1';
+        loop
+            wait until BLANK = '0';
+            t_low := now;
+            wait until BLANK = '1';
+            want := BCM_UNIT_RST * 2**plane * MATRIX_CLK_period;
+            blank_low_time <= now - t_low;
+            blank_plane <= plane;
+            assert abs(now - t_low - want) < MATRIX_CLK_period/2
+                report "BLANK low for " & time'image(now - t_low) & " on plane " & integer'image(plane) &
+                       ", expected " & time'image(want)
+                severity error;
+            plane := (plane + 1) mod BCM_BITS_TB;
+        end loop;
+    end process;
+
+    -- the panel must be dark while a plane is latched
+    assert not (LATCH = '1' and BLANK = '0')
+        report "LATCH while the panel is lit" severity error;
+
     -- Stimulus process
     stim_proc: process
     procedure gpmc_send (RW   : std_logic;
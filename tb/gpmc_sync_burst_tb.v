@@ -0,0 +1,224 @@
+//------------------------------------------------------------------------------
+// Project      : Opallios
+//------------------------------------------------------------------------------
+// File         : gpmc_sync_burst_tb.v
+//------------------------------------------------------------------------------
+// Description  : Testbench for the gpmc_sync burst write path (BURST = 1).
+//                Drives single writes with WEn held as long as the beat timing
+//                allows, full and overlong bursts, reads and back to back
+//                bursts, with filler on the bus between beats, and checks the
+//                words on wr_stb against the ones sent. With EXPECT_OVF the
+//                clk side is made too slow on purpose, words may then be
+//                dropped but the ones that arrive must be right, and wr_ovf
+//                must be set. Prints PASS or FAIL and stops.
+//------------------------------------------------------------------------------
+`timescale 1ns / 1ps
+
+module gpmc_sync_burst_tb #(
+    parameter BURST_LEN = 8,
+    parameter WR_FIRST_BEAT = 2,
+    parameter BEAT_CLKS = 2,
+    parameter CLK_HALF = 5.0,       // clk half period, 100 MHz
+    parameter GPMC_HALF = 6.0,      // gpmc_clk half period, 83 MHz
+    parameter GPMC_PHASE = 0.0,     // gpmc_clk start delay against clk
+    parameter EXPECT_OVF = 0
+);
+
+reg clk = 1'b0;
+reg gpmc_clk = 1'b0;
+reg gpmc_csn1 = 1'b1;
+reg gpmc_advn = 1'b1;
+reg gpmc_wen = 1'b1;
+reg gpmc_oen = 1'b1;
+reg [15:0] ad_drv = 16'h0000;
+reg ad_en = 1'b0;
+wire [15:0] gpmc_ad = ad_en ? ad_drv : 16'hzzzz;
+
+wire wr_stb;
+wire [15:0] wr_addr;
+wire [15:0] wr_data;
+wire wr_ovf;
+
+always #(CLK_HALF) clk = !clk;
+initial begin
+    #(GPMC_PHASE);
+    forever #(GPMC_HALF) gpmc_clk = !gpmc_clk;
+end
+
+gpmc_sync #(
+    .ADDR_WIDTH(16),
+    .DATA_WIDTH(16),
+    .BURST(1),
+    .BURST_LEN(BURST_LEN),
+    .WR_FIRST_BEAT(WR_FIRST_BEAT),
+    .BEAT_CLKS(BEAT_CLKS)
+) dut (
+    .clk(clk),
+    .gpmc_ad(gpmc_ad),
+    .gpmc_advn(gpmc_advn),
+    .gpmc_csn1(gpmc_csn1),
+    .gpmc_wen(gpmc_wen),
+    .gpmc_oen(gpmc_oen),
+    .gpmc_clk(gpmc_clk),
+    .oe(),
+    .we(),
+    .cs(),
+    .address(),
+    .data_out(),
+    .data_in(16'h5a5a),
+    .wr_stb(wr_stb),
+    .wr_addr(wr_addr),
+    .wr_data(wr_data),
+    .wr_ovf(wr_ovf)
+);
+
+// words expected on wr_stb, in order
+reg [15:0] exp_addr [0:1023];
+reg [15:0] exp_data [0:1023];
+integer exp_wr = 0;
+integer exp_rd = 0;
+integer errors = 0;
+integer dropped = 0;
+reg [15:0] seq = 16'h1000;
+
+always @ (posedge clk)
+begin
+    if (wr_stb) begin
+        // after an overflow whole words are missing, never wrong ones
+        while (EXPECT_OVF && (exp_rd < exp_wr) &&
+               ((exp_addr[exp_rd] != wr_addr) || (exp_data[exp_rd] != wr_data))) begin
+            exp_rd = exp_rd + 1;
+            dropped = dropped + 1;
+        end
+        if (exp_rd >= exp_wr) begin
+            $display("%t ERROR: unexpected write %h <= %h", $time, wr_addr, wr_data);
+            errors = errors + 1;
+        end else begin
+            if ((exp_addr[exp_rd] != wr_addr) || (exp_data[exp_rd] != wr_data)) begin
+                $display("%t ERROR: write %h <= %h, expected %h <= %h", $time,
+                         wr_addr, wr_data, exp_addr[exp_rd], exp_data[exp_rd]);
+                errors = errors + 1;
+            end
+            exp_rd = exp_rd + 1;
+        end
+    end
+end
+
+task expect_word(input [15:0] a, input [15:0] d);
+begin
+    exp_addr[exp_wr] = a;
+    exp_data[exp_wr] = d;
+    exp_wr = exp_wr + 1;
+end
+endtask
+
+task bus_idle(input integer clks);
+    integer i;
+begin
+    @ (posedge gpmc_clk) #1;
+    gpmc_csn1 = 1'b1;
+    gpmc_advn = 1'b1;
+    gpmc_wen = 1'b1;
+    gpmc_oen = 1'b1;
+    ad_en = 1'b0;
+    for (i = 1; i < clks; i = i + 1)
+        @ (posedge gpmc_clk);
+end
+endtask
+
+task addr_phase(input [15:0] a);
+begin
+    @ (posedge gpmc_clk) #1;
+    gpmc_csn1 = 1'b0;
+    gpmc_advn = 1'b0;
+    gpmc_wen = 1'b1;
+    gpmc_oen = 1'b1;
+    ad_drv = a;
+    ad_en = 1'b1;
+end
+endtask
+
+// Write n words from a, the beats on the configured timing and filler on the
+// bus in between. WEn stays low for hold clocks after the last beat, less
+// than BEAT_CLKS is a legal access. Words past BURST_LEN are not expected.
+task gpmc_write(input [15:0] a, input integer n, input integer hold);
+    integer j, beat, last;
+begin
+    addr_phase(a);
+    last = WR_FIRST_BEAT + (n - 1) * BEAT_CLKS + hold;
+    beat = 0;
+    for (j = 1; j <= last; j = j + 1) begin
+        @ (posedge gpmc_clk) #1;
+        gpmc_advn = 1'b1;
+        gpmc_wen = 1'b0;
+        if ((j >= WR_FIRST_BEAT) && (((j - WR_FIRST_BEAT) % BEAT_CLKS) == 0) && (beat < n)) begin
+            ad_drv = seq;
+            if (beat < BURST_LEN)
+                expect_word(a + beat, seq);
+            seq = seq + 1;
+            beat = beat + 1;
+        end else
+            ad_drv = 16'hbad0 + j;
+    end
+    bus_idle(1);
+end
+endtask
+
+task gpmc_read(input [15:0] a);
+    integer j;
+begin
+    addr_phase(a);
+    for (j = 1; j <= WR_FIRST_BEAT + 2; j = j + 1) begin
+        @ (posedge gpmc_clk) #1;
+        gpmc_advn = 1'b1;
+        gpmc_oen = 1'b0;
+        ad_en = 1'b0;
+    end
+    bus_idle(1);
+end
+endtask
+
+integer k;
+
+initial begin
+    bus_idle(8);
+
+    // single writes, WEn held as long as the timing allows
+    gpmc_write(16'h0000, 1, BEAT_CLKS - 1);
+    bus_idle(4);
+    gpmc_write(16'h0001, 1, 0);
+    bus_idle(4);
+    // a read in between takes no words
+    gpmc_read(16'h0000);
+    bus_idle(4);
+    // a full burst, then one the host should never send with WEn held past the page
+    gpmc_write(16'h2000, BURST_LEN, BEAT_CLKS - 1);
+    bus_idle(4);
+    gpmc_write(16'h2100, BURST_LEN + 3, 0);
+    bus_idle(4);
+    // short bursts, like the 16 and 32 bit store tails
+    gpmc_write(16'h2200, 2, 0);
+    gpmc_write(16'h2300, 3, 0);
+    // back to back full bursts, the FIFO must keep up
+    for (k = 0; k < 16; k = k + 1)
+        gpmc_write(16'h4000 + k * BURST_LEN, BURST_LEN, 0);
+
+    bus_idle(200);
+
+    if (!EXPECT_OVF && (exp_rd != exp_wr)) begin
+        $display("ERROR: %0d of %0d words never arrived", exp_wr - exp_rd, exp_wr);
+        errors = errors + 1;
+    end
+    if (wr_ovf != EXPECT_OVF) begin
+        $display("ERROR: wr_ovf is %b, expected %0d", wr_ovf, EXPECT_OVF);
+        errors = errors + 1;
+    end
+    if (errors == 0)
+        $display("PASS: %0d words, %0d dropped, first beat %0d, beat %0d clocks",
+                 exp_wr, dropped + exp_wr - exp_rd, WR_FIRST_BEAT, BEAT_CLKS);
+    else
+        $display("FAIL: %0d errors", errors);
+    $finish;
+end
+
+endmodule